@@ -36,5 +36,7 @@ void srandom(unsigned long seed);
  */
 void *malloc(size_t size);
 void free(void *ptr);
+void *calloc(size_t nmemb, size_t size);
+void *realloc(void *ptr, size_t size);
 
 #endif /* _STDLIB_H_ */
@@ -0,0 +1,16 @@
+#ifndef _SYS_VMSTAT_H_
+#define _SYS_VMSTAT_H_
+
+/*
+ * Get struct vmcounts and the histogram size from the kernel
+ */
+#include <kern/vmstat.h>
+
+/*
+ * Fetches the virtual memory counters of process pid into counts, and
+ * the fault time histogram of the whole system, VMSTAT_NBUCKETS entries,
+ * into hist. Either pointer may be NULL.
+ */
+int vmstat(pid_t pid, struct vmcounts *counts, unsigned int *hist);
+
+#endif /* _SYS_VMSTAT_H_ */
@@ -7,6 +7,7 @@
 #include <kern/callno.h>
 #include <syscall.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 
 /*
@@ -118,6 +119,41 @@ void mips_syscall(struct trapframe *tf)
             break;
         #endif /* OPT_A2 */
 
+        #if OPT_A3
+            case SYS_sbrk:
+                err = 0;
+                retval = (int32_t)sys_sbrk((intptr_t)tf->tf_a0, &err);
+            break;
+
+            case SYS___time:
+                err = 0;
+                retval = sys___time((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1, &err);
+            break;
+
+            case SYS_mmap:
+                // fd and offset are passed on the user stack
+                err = 0;
+                retval = (int32_t)sys_mmap((void *)tf->tf_a0, (size_t)tf->tf_a1,
+                        (int)tf->tf_a2, (int)tf->tf_a3,
+                        (userptr_t)(tf->tf_sp + 16), &err);
+            break;
+
+            case SYS_munmap:
+                err = 0;
+                retval = sys_munmap((void *)tf->tf_a0, (size_t)tf->tf_a1, &err);
+            break;
+
+            case SYS_msync:
+                err = 0;
+                retval = sys_msync((void *)tf->tf_a0, (size_t)tf->tf_a1, (int)tf->tf_a2, &err);
+            break;
+
+            case SYS_vmstat:
+                err = 0;
+                retval = sys_vmstat((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1, (userptr_t)tf->tf_a2, &err);
+            break;
+        #endif /* OPT_A3 */
+
         default:
             kprintf("Unknown syscall %d\n", callno);
             err = ENOSYS;
@@ -12,6 +12,7 @@
 #include <processtable.h>
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 extern u_int32_t curkstack;
 
@@ -92,6 +93,16 @@ mips_trap(struct trapframe *tf)
 		assert((vaddr_t)tf < (vaddr_t)(curthread->t_stack+STACK_SIZE));
 	}
 
+#if OPT_A3
+	/*
+	 * Remember where the user stack pointer was, so page faults can
+	 * tell the stack growing from stray accesses below it.
+	 */
+	if (!iskern && curthread != NULL) {
+		curthread->t_usersp = tf->tf_sp;
+	}
+#endif /* OPT_A3 */
+
 	/* Interrupt? Call the interrupt handler and return. */
 	if (code == EX_IRQ) {
 		mips_interrupt(tf->tf_cause);
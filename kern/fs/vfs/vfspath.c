@@ -8,6 +8,7 @@
 #include <kern/unistd.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <pagecache.h>
 #include <lib.h>
 
 
@@ -78,6 +79,8 @@ vfs_open(char *path, int openflags, struct vnode **ret)
 			VOP_DECREF(vn);
 			return result;
 		}
+		/* Cached pages of the old contents are no good now. */
+		pagecache_purge(vn);
 	}
 
 	*ret = vn;
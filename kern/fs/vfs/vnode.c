@@ -6,6 +6,7 @@
 #include <lib.h>
 #include <synch.h>
 #include <vnode.h>
+#include <pagecache.h>
 
 /*
  * Initialize an abstract vnode.
@@ -88,6 +89,8 @@ vnode_decref(struct vnode *vn)
 	lock_release(vn->vn_countlock);
 
 	if (actually_do_it) {
+		/* Nobody can look up the cached pages of vn any more. */
+		pagecache_purge(vn);
 		result = VOP_RECLAIM(vn);
 		if (result != 0 && result != EBUSY) {
 			// XXX: lame.
@@ -6,6 +6,21 @@
 #include "opt-A3.h"
 
 struct vnode;
+struct pagetable;
+
+#if OPT_A3
+// a region set up by mmap. file mappings hold a reference to their vnode,
+// anonymous ones have none
+struct mmap_region {
+    vaddr_t mr_start;
+    size_t mr_npages;
+    int mr_prot;      // PROT_* flags
+    int mr_flags;     // MAP_* flags
+    struct vnode *mr_vnode;
+    u_int32_t mr_offset;
+    struct mmap_region *mr_next;
+};
+#endif // OPT_A3
 
 /* 
  * Address space - data structure associated with the virtual memory
@@ -38,7 +53,20 @@ struct addrspace {
     u_int32_t as_offset2;
     u_int32_t as_flags2;
 
-	paddr_t as_stackpbase;
+    // heap, from the end of the last segment up to the break set by sbrk
+    vaddr_t as_heapbase;
+    vaddr_t as_heaptop;
+
+    // lowest address of the stack, which grows down from USERSTACK, and
+    // the most pages it may grow to
+    vaddr_t as_stackbase;
+    u_int32_t as_stacklimit;
+
+    // regions set up by mmap, highest first. they are placed top down
+    // from below the stack's limit
+    struct mmap_region *as_mmaps;
+
+    struct pagetable *as_pt;
 #endif
 };
 
@@ -113,6 +141,8 @@ int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 #define SEG_TEXT 0x1
 #define SEG_DATA 0x2
 #define SEG_STCK 0x3
+#define SEG_HEAP 0x4
+#define SEG_MMAP 0x5
 
 // segment flags
 #define SEG_RD 0x1 // segment readable
@@ -126,6 +156,38 @@ int as_contains(struct addrspace *as, vaddr_t vaddr);
 // returns true if writeable else returns 0
 int as_writeable(struct addrspace *as, vaddr_t vaddr);
 
+// moves the heap break by amount bytes and hands back the old break.
+// pages given up by a shrinking heap are freed
+int as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldtop);
+
+// extends the stack down to vaddr if it is within the stack limit of
+// USERSTACK, clear of the other segments, and no more than VM_STACKSLACK
+// below sp, the user stack pointer. returns SEG_STCK if it did, 0
+// otherwise
+int as_grow_stack(struct addrspace *as, vaddr_t vaddr, vaddr_t sp);
+
+// sets the stack limit, in pages, of address spaces created from now
+// on. it is kept between VM_STACKPAGES and VM_MAXSTACKPAGES. forked
+// children keep their parent's
+void as_set_stack_limit(u_int32_t npages);
+u_int32_t as_get_stack_limit(void);
+
+// maps len bytes of v from offset, or zero-filled pages if v is NULL,
+// at an address of the kernel's choosing, handed back in addr
+int as_mmap(struct addrspace *as, size_t len, int prot, int flags,
+            struct vnode *v, u_int32_t offset, vaddr_t *addr);
+
+// removes the mapping starting at addr, writing back its modified pages
+// if it is a shared file mapping. len must cover the whole mapping
+int as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+
+// writes back the modified pages of shared file mappings between addr
+// and addr + len
+int as_msync(struct addrspace *as, vaddr_t addr, size_t len);
+
+// returns the mapping containing vaddr, NULL if there is none
+struct mmap_region *as_find_mmap(struct addrspace *as, vaddr_t vaddr);
+
 #endif // OPT_A3
 
 
@@ -1,23 +1,119 @@
 #ifndef _COREMAP_H_
 #define _COREMAP_H_
 
-// paddr -> the physical address of the page
-// use -> is the address in use by a page?
-// size -> the size of the page loaded on that address
-//          0 -> completely free
-//         -1 -> index is part of a contiguous block
+struct pagetable;
+
+// One packed entry per physical frame, stored in a single array stolen
+// from RAM before the heap comes up. The physical address of a frame is
+// not stored; it is derived from the entry's index.
+//
+// use -> is the frame in use?
+// tail -> the frame is in use but is not the first frame of its block.
+//         an allocation is its first frame plus the run of tails after it
+// order -> if the frame heads a free buddy block, log2 of the block size
+//          CM_NOT_HEAD otherwise
+// next, prev -> links of the per-order free list the block is on
+// owner, vpn -> reverse map of a user page: the page table mapping the
+//               frame and the virtual page number it is mapped at.
+//               owner is NULL for kernel pages, and for shared pages
+//               whose owner has let go of them
+// refcount -> number of page tables mapping a user page. pages shared
+//             copy-on-write after fork have more than one
+// ref -> software reference bit used by clock replacement
+// readahead -> the page was read in from swap ahead of use and has not
+//              been touched since
+// swapslot -> swapfile slot still holding an up to date copy of a clean
+//             user page, CM_NO_SWAPSLOT if there is none
+//
+// The coremap's lock is the interrupt level: every function below does
+// its work at splhigh and none of them sleep. A sleeping lock would not
+// do, kmalloc allocates from here with any lock held. Callers that need
+// a page to stay put across I/O hold the lock of the page table owning it
+// (see pt.h) or an extra reference to it.
+
+#define CM_NORDERS 18 // free blocks of up to 2^17 pages (512MB)
+#define CM_NOT_HEAD 0x1f
+#define CM_NO_LINK 0x1ffffff
+#define CM_NO_SWAPSLOT 0xfff
+#define CM_MAX_REFCOUNT 31
 
 struct coremap_entry {
-    paddr_t paddr;
-    //vaddr_t vaddr; // not in use.. yet?
-    // todo: need pid
-    u_int32_t use;
-    int size;
+    u_int32_t use : 1;
+    u_int32_t tail : 1;
+    u_int32_t order : 5;
+    u_int32_t next : 25;
+    u_int32_t prev : 25;
+    u_int32_t ref : 1;
+    u_int32_t readahead : 1;
+    u_int32_t refcount : 5;
+    struct pagetable *owner;
+    u_int32_t vpn : 20;
+    u_int32_t swapslot : 12;
 };
 
 void coremap_bootstrap();
+// allocates npages contiguous frames. their contents are left as they are,
+// so callers that do not overwrite all of it must clear it themselves
 paddr_t getppages(unsigned long npages);
 void ungetppages(paddr_t paddr);
 
-#endif // _COREMAP_H_
+// allocates one frame filled with zeros, from the pre-zeroed pool if it
+// has any
+paddr_t getzeroedpage();
+// zeroes one free frame into the pool if it is not full. called by the
+// scheduler with interrupts off instead of idling, which lets interrupts
+// in between calls. returns 0 if there was nothing to do
+int coremap_prezero();
+
+// records which page table maps the user page at paddr, and where. the
+// page is then mapped by that page table only
+void coremap_set_owner(paddr_t paddr, struct pagetable *pt, vaddr_t vaddr);
+
+// adds a mapping of the user page at paddr. returns 0 if the page already
+// has CM_MAX_REFCOUNT of them
+int coremap_share(paddr_t paddr);
+// drops pt's mapping of the user page at paddr and returns how many are
+// left. the page must be freed by the caller once there are none
+u_int32_t coremap_unshare(paddr_t paddr, struct pagetable *pt);
+u_int32_t coremap_refcount(paddr_t paddr);
+// makes pt the owner of a page it is the last user of, if nobody owns it
+void coremap_claim(paddr_t paddr, struct pagetable *pt, vaddr_t vaddr);
+
+// number of frames holding user pages, shared or not
+u_int32_t coremap_nuser(void);
+
+// marks the user page at paddr as recently used
+void coremap_set_referenced(paddr_t paddr);
 
+// moves the clock hand over unshared user pages, giving referenced pages
+// a second chance. pages of page tables above their working set are
+// taken first. the hand moves at most *budget frames, which is reduced
+// by as many. returns the frame to evict and its reverse mapping in pt
+// and vaddr, or 0 if the budget ran out first
+paddr_t coremap_clock_victim(struct pagetable **pt, vaddr_t *vaddr,
+                             u_int32_t *budget);
+
+// passes the unshared user pages among npages frames from start to
+// pt_ws_account for working set sampling, clearing the reference bits it
+// asks for. their TLB entries stay. called at splhigh
+void coremap_ws_scan(u_int32_t start, u_int32_t npages);
+
+// remembers that the clean page at paddr is also in swap slot slot.
+// CM_NO_SWAPSLOT forgets it
+void coremap_set_swapslot(paddr_t paddr, u_int32_t slot);
+u_int32_t coremap_get_swapslot(paddr_t paddr);
+
+// marks the user page at paddr as read ahead. it starts out unreferenced
+// so the clock takes it first if it is not used
+void coremap_set_readahead(paddr_t paddr);
+// clears the readahead mark of the page at paddr, returns whether it was set
+int coremap_take_readahead(paddr_t paddr);
+
+// number of free frames, and of frames managed by the coremap
+u_int32_t coremap_nfree();
+u_int32_t coremap_npages();
+
+// prints free list occupancy and fragmentation of physical memory
+void coremap_printstats();
+
+#endif // _COREMAP_H_
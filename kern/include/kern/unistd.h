@@ -34,6 +34,26 @@
 #define SEEK_CUR      1      /* Seek relative to current position in file */
 #define SEEK_END      2      /* Seek relative to end of file */
 
+/* Protection for mmap: PROT_NONE or any of the others or'd together */
+#define PROT_NONE     0      /* Pages may not be accessed */
+#define PROT_READ     1      /* Pages may be read */
+#define PROT_WRITE    2      /* Pages may be written */
+#define PROT_EXEC     4      /* Pages may be executed */
+
+/* Flags for mmap: choose one of these: */
+#define MAP_SHARED    1      /* Changes are written back to the file */
+#define MAP_PRIVATE   2      /* Changes stay private to the process */
+/* then or in any of these: */
+#define MAP_ANON      4      /* Zero-filled memory, not backed by a file */
+
+/* Returned by mmap on failure */
+#define MAP_FAILED    ((void *)-1)
+
+/* Flags for msync */
+#define MS_SYNC       1      /* Write back before returning */
+#define MS_ASYNC      2      /* Same as MS_SYNC in this system */
+#define MS_INVALIDATE 4      /* Ignored; mappings of a file are coherent */
+
 /* The codes for ioctl are in kern/ioctl.h */
 /* The codes for stat/fstat/lstat are in kern/stat.h */
 
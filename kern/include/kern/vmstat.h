@@ -0,0 +1,24 @@
+#ifndef _KERN_VMSTAT_H_
+#define _KERN_VMSTAT_H_
+
+/*
+ * Virtual memory counters of a process, for the vmstat system call.
+ */
+
+struct vmcounts {
+	u_int32_t vc_tlbfaults;		/* TLB misses */
+	u_int32_t vc_zerofills;		/* pages faulted in as zeros */
+	u_int32_t vc_elfreads;		/* pages faulted in from the executable */
+	u_int32_t vc_swapreads;		/* pages faulted in from swap */
+	u_int32_t vc_swapwrites;	/* pages swapped out to make room */
+};
+
+/*
+ * Number of buckets of the histogram of the time taken to handle a
+ * fault, for all processes. Bucket 0 counts faults that took less than
+ * a microsecond, bucket i faults that took from 2^(i-1) to 2^i
+ * microseconds, and the last bucket anything longer.
+ */
+#define VMSTAT_NBUCKETS 20
+
+#endif /* _KERN_VMSTAT_H_ */
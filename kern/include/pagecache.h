@@ -0,0 +1,60 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+struct vnode;
+struct uio;
+struct pagetable;
+
+// Cache of resident pages of regular files, keyed by vnode and page
+// aligned file offset, shared by file reads and writes and by the VM.
+// Read only pages of an executable are entered when they are faulted in,
+// and any page of a file when it is read, so exec and read of the same
+// file find the same frame.
+//
+// A cached frame counts a coremap reference for every page table mapping
+// it and for every read or write copying through it. Frames nobody
+// references are idle: they stay cached on an LRU list and are the first
+// thing given up when the frame allocator runs out.
+
+// read and write for regular files through the cache. other vnodes go
+// straight to VOP_READ and VOP_WRITE. writes go through to the file
+int pagecache_read(struct vnode *v, struct uio *u);
+int pagecache_write(struct vnode *v, struct uio *u);
+
+// returns the frame holding the page of v at offset, 0 if none does
+paddr_t pagecache_lookup(struct vnode *v, u_int32_t offset);
+
+// same, but also takes a reference to the frame for a mapping of it by
+// pt at vaddr. pt is NULL for a reference that is not a mapping. returns
+// 0 if the frame already has the most references it can
+paddr_t pagecache_get(struct vnode *v, u_int32_t offset, struct pagetable *pt,
+                      vaddr_t vaddr);
+
+// records that the frame at paddr holds the page of v at offset. does
+// nothing if that page is already cached or there is no memory
+void pagecache_insert(struct vnode *v, u_int32_t offset, paddr_t paddr);
+
+// called when the last reference to the frame at paddr is gone. returns
+// 1 if the frame stays in the cache, 0 if the caller must free it
+int pagecache_unmapped(paddr_t paddr);
+
+// forgets the frame at paddr, if it is in the cache. for frames that are
+// about to be reused
+void pagecache_remove(paddr_t paddr);
+
+// whether the frame at paddr is in the cache
+int pagecache_cached(paddr_t paddr);
+
+// writes the page held by the frame at paddr back to its file, up to
+// the end of the file. returns 0 if the frame is not in the cache, 1
+// otherwise with the outcome of the write in err
+int pagecache_writeback(paddr_t paddr, int *err);
+
+// frees the least recently used idle frame. returns 0 if there is none.
+// must be called at splhigh
+int pagecache_reclaim(void);
+
+// drops every page of v, for when v goes away or is truncated
+void pagecache_purge(struct vnode *v);
+
+#endif // _PAGECACHE_H_
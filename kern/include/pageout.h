@@ -0,0 +1,24 @@
+#ifndef _PAGEOUT_H_
+#define _PAGEOUT_H_
+
+// Background pageout daemon. It sleeps until the number of free frames
+// drops below the low watermark, then evicts pages until it is back at
+// the high watermark, so most page faults find a free frame waiting.
+
+// sets the default watermarks and starts the daemon
+void pageout_bootstrap(void);
+
+// wakes the daemon if nfree is below the low watermark. called by the
+// frame allocator at splhigh
+void pageout_check(u_int32_t nfree);
+
+// lets a daemon that found nothing to evict try again. called by the
+// frame allocator at splhigh when a frame is freed
+void pageout_freed(void);
+
+// changes the watermarks. returns EINVAL unless low < high and high is
+// at most the number of frames
+int pageout_set_watermarks(u_int32_t low, u_int32_t high);
+void pageout_get_watermarks(u_int32_t *low, u_int32_t *high);
+
+#endif // _PAGEOUT_H_
@@ -2,6 +2,7 @@
 #define _PROCESS_H_
 
 #include <types.h>
+#include <kern/vmstat.h>
 
 #define MAX_PROCESSES 10
 
@@ -11,11 +12,11 @@ struct process {
     pid_t parentpid; // the pid of this process’s parent
     pid_t pid; // the pid of this process
     struct filetable* file_table; // table of files currently opened in the process
-    struct pagetable* page_table;
     struct array * p_childrenpids; // a list of all of this process’s children
     struct cv* p_waitcv; // condition variable in which to wait on
     struct lock* p_lock; // lock to be used for synchronization during wait
     struct thread* p_thread; // reference to the thread that this process holds
+    struct vmcounts p_vmcounts; // paging done by or for the process
 };
 
 // bootstraps initial process. calls thread bootstrap and processtable bootstrap
@@ -8,6 +8,7 @@
 #include <types.h>
 
 struct process;
+struct vmcounts;
 
 // bootstraps processtable
 void processtable_bootstrap();
@@ -23,6 +24,10 @@ void processtable_remove(pid_t pid);
 // returns process with the given pid. If pid is invalid or process does not exist, panics
 struct process* processtable_get(pid_t pid);
 
+// copies the vm counters of the process with the given pid into vc.
+// returns -1 if the process does not exist
+int processtable_getvmcounts(pid_t pid, struct vmcounts *vc);
+
 // For debugging purposes only
 int processtable_getnum(); // size of table - NULL(freed) entries
 int processtable_getsize(); // size of table
@@ -7,24 +7,97 @@
 #define IS_VALID(x)      ((x) & 0x00000001)
 #define IS_DIRTY(x)      ((x) & 0x00000002)
 #define IS_SWAPPED(x)    ((x) & 0x00000004)
+#define IS_COW(x)        ((x) & 0x00000008)
 #define SET_VALID(x)     ((x) | 0x00000001)
 #define SET_DIRTY(x)     ((x) | 0x00000002)
 #define SET_SWAPPED(x)   ((x) | 0x00000004)
+#define SET_COW(x)       ((x) | 0x00000008)
 #define SET_INVALID(x)   ((x) & 0xfffffffe)
+#define CLEAR_COW(x)     ((x) & 0xfffffff7)
+#define CLEAR_DIRTY(x)   ((x) & 0xfffffffd)
 
 #define N_OUT (1024)
 #define N_IN (1024)
 #define IN_MASK (0x003FF000)
 
+// most pages read from the executable per page fault
+#define ELF_CLUSTER 8
+
 struct pagetable;
 
+// the address an entry maps follows from its place in the table, so a
+// second level table fits in one page
 struct pt_entry {
-    vaddr_t vaddr;
     paddr_t paddr;
 };
 
 struct pagetable* pt_create();
 void pt_destroy(struct pagetable* pt);
-paddr_t pt_lookup(struct pagetable *pt, vaddr_t vaddr, int *err);
+
+// every page table has a lock, held while its entries change, including
+// across the disk I/O of a fault. a thread may hold its own page table's
+// lock and then only tries for others' when it evicts their pages,
+// passing them over if they are busy, so nobody ever waits for a page
+// table lock while holding another one. pt_lookup and pt_set_dirty must
+// be called with the lock held, the other functions take it themselves
+void pt_lock(struct pagetable *pt);
+void pt_unlock(struct pagetable *pt);
+
+// wakes threads waiting for a page table lock to come free or a frame to
+// be freed so they can evict something. called by pt_unlock and by the
+// frame allocator
+void pt_evict_wakeup(void);
+
+// makes the TLB map pt's pages. the entries of the page table that had
+// it are saved and put back when that one is activated again. nothing
+// is done if pt already has the TLB
+void pt_activate(struct pagetable *pt);
+
+// drops the TLB entry for vaddr of owner, from the TLB if owner has it,
+// or from the entries saved for owner otherwise
+void pt_tlb_invalidate(struct pagetable *owner, vaddr_t vaddr);
+
+// makes new map everything old maps. resident pages are shared
+// copy-on-write and swapped out pages share their swap slot
+int pt_copy(struct pagetable *old, struct pagetable *new);
+
+// returns the frame mapped at vaddr, faulting it in if needed. the dirty
+// bit of the entry is passed back in the low bits of the result. write
+// marks the page dirty (vaddr must be in a writable segment)
+paddr_t pt_lookup(struct pagetable *pt, vaddr_t vaddr, int write, int *err);
+
+// throws away the pages between start and end, resident or swapped
+void pt_unmap(struct pagetable *pt, vaddr_t start, vaddr_t end);
+
+// writes the modified pages of shared file mappings between start and
+// end back to their file. they are clean afterwards
+int pt_msync(struct pagetable *pt, vaddr_t start, vaddr_t end);
+
+// marks the resident page at vaddr as modified and returns its frame
+paddr_t pt_set_dirty(struct pagetable *pt, vaddr_t vaddr);
+
+// sets how many pages are read from the executable per page fault,
+// between 1 (only the faulting page) and ELF_CLUSTER
+void pt_set_fault_around(u_int32_t npages);
+u_int32_t pt_get_fault_around(void);
+
+// working set estimation. over every few clock ticks, each page table
+// that ran since the last time counts its resident pages referenced since
+// then. that is its working set, and the clock evicts pages of page
+// tables holding well more than theirs before anyone else's.
+// pt_ws_tick is called by hardclock and scans a slice of memory each time
+void pt_ws_tick(void);
+// counts a resident page of pt during the sampling scan, and returns
+// whether its reference bit is to be cleared for the next sample
+int pt_ws_account(struct pagetable *pt, int referenced);
+// whether pt holds more pages than its working set calls for. with NULL,
+// whether any page table does
+int pt_ws_over(struct pagetable *pt);
+
+// frees an idle page cache frame, or evicts a batch of user pages from
+// any address space and frees their frames. returns 0 if there was
+// nothing to evict. only with global
+// (clock) replacement
+int pt_reclaim(void);
 
 #endif // _PT_H_
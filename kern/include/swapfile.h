@@ -4,22 +4,50 @@
 #include "types.h"
 #include "pt.h"
 
-#define MAX_SWAPFILE_SIZE (9*1024*1024) // 9MB
-#define MAX_SWAPPED_PAGES (MAX_SWAPFILE_SIZE / PAGE_SIZE)
+#define MAX_SWAPFILE_SIZE (9*1024*1024) // 9MB, when swapping to a file
+// slots below this can be kept compressed in memory, and can stay
+// attached to a clean page that was swapped back in. the coremap names a
+// slot in 12 bits and keeps the all ones value for none
+#define MAX_SWAPPED_PAGES (0xfff)
+// most slots there can be, swapping to a device. a swapped out entry
+// keeps its slot in the 20 frame bits
+#define SWAP_MAX_SLOTS (0xfffff)
+#define SWAP_CLUSTER (8) // most dirty pages written out in one go
 
 struct vnode *swapfile;
 
-// maps a swapped page to its Location/offset in the swapfile
-// based on it's index in the array
+// slot in the swapfile of a swapped out page table entry
+#define SWAP_SLOT(x) (ALIGN(x) >> 12)
 
+// writes the page to a free slot and points pte at the slot
 int swapout(struct pt_entry *pte);
-int swapin(struct pt_entry *pte);
+// writes npages pages to consecutive slots with a single write
+int swapout_cluster(struct pt_entry **ptes, u_int32_t npages);
+// reads the page into the frame at paddr. the slot stays allocated
+int swapin(struct pt_entry *pte, paddr_t paddr);
+// reads npages pages from consecutive slots, starting with the slot of
+// ptes[0], into frames with a single read
+int swapin_cluster(struct pt_entry **ptes, paddr_t *frames,
+                   u_int32_t npages);
+// adds a user of a slot, for entries shared by fork. returns 0 if the
+// slot already has the most users it can count
+int swap_dup(u_int32_t slot);
+// drops a user of a slot. the slot is free once it has none
+void swap_free(u_int32_t slot);
 
 int evict();
 int write_to_swapfile(vaddr_t vaddr, u_int32_t offset);
 int read_from_swapfile(vaddr_t vaddr, u_int32_t offset);
 
 void swapfile_bootstrap(void);
+
+// swaps to the raw block device devname (e.g. "lhd1raw:") from now on,
+// sized to the device. page I/O then goes straight to the device instead
+// of through a filesystem. returns EBUSY if anything is swapped out
+int swap_set_device(char *devname);
+// returns the name of the device swapped to, NULL for the swapfile, and
+// the number of slots in npages
+const char *swap_get_device(u_int32_t *npages);
 void test_swapin();
 
 #endif /* _SWAPFILE_H_ */
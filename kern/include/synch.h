@@ -42,6 +42,8 @@ void              sem_destroy(struct semaphore *);
  *                   same time.
  *    lock_release - Free the lock. Only the thread holding the lock may do
  *                   this.
+ *    lock_tryacquire - Get the lock if nobody holds it, without waiting.
+ *                   Returns true if it did.
  *    lock_do_i_hold - Return true if the current thread holds the lock; 
  *                   false otherwise.
  *
@@ -68,6 +70,7 @@ struct lock {
 struct lock *lock_create(const char *name);
 void         lock_acquire(struct lock *);
 void         lock_release(struct lock *);
+int          lock_tryacquire(struct lock *);
 int          lock_do_i_hold(struct lock *);
 void         lock_destroy(struct lock *);
 
@@ -3,6 +3,7 @@
 
 #include <types.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -35,5 +36,15 @@ int sys_reboot(int code);
 
 #endif /* OPT_A2 */
 
+#if OPT_A3
+    void *sys_sbrk(intptr_t amount, int *err);
+    time_t sys___time(userptr_t seconds, userptr_t nanoseconds, int *err);
+    void *sys_mmap(void *addr, size_t len, int prot, int flags,
+                   userptr_t stackargs, int *err);
+    int sys_munmap(void *addr, size_t len, int *err);
+    int sys_msync(void *addr, size_t len, int flags, int *err);
+    int sys_vmstat(pid_t pid, userptr_t counts, userptr_t hist, int *err);
+#endif /* OPT_A3 */
+
 
 #endif /* _SYSCALL_H_ */
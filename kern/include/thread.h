@@ -8,6 +8,7 @@
 /* Get machine-dependent stuff */
 #include <machine/pcb.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 
 struct addrspace;
@@ -50,6 +51,19 @@ struct thread {
     #if OPT_A2
 		pid_t pid;
     #endif // OPT_A2
+
+    // VM counters of the process holding the thread, charged for the
+    // paging the thread does. NULL for kernel threads, and once the
+    // process has exited and may be gone
+    #if OPT_A3
+        struct vmcounts *t_vmcounts;
+    #endif // OPT_A3
+
+    // user stack pointer at the last trap from user mode, which faults
+    // taken in the kernel on behalf of the process go by too
+    #if OPT_A3
+        vaddr_t t_usersp;
+    #endif // OPT_A3
 };
 
 /* Call once during startup to allocate data structures. */
@@ -144,6 +158,12 @@ int thread_hassleepers(const void *addr);
  */
 int one_thread_only(void);
 
+/*
+ * Registers a kernel thread that runs until shutdown, such as the
+ * pageout daemon, so one_thread_only() does not wait for it.
+ */
+void thread_count_daemon(void);
+
 /*
  * Private thread functions.
  */
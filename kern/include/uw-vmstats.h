@@ -45,7 +45,34 @@
 #define VMSTAT_ELF_FILE_READ          (7)
 #define VMSTAT_SWAP_FILE_READ         (8)
 #define VMSTAT_SWAP_FILE_WRITE        (9)
-#define VMSTAT_COUNT                 (10)
+#define VMSTAT_COREMAP_ALLOC         (10)
+#define VMSTAT_COREMAP_ALLOC_STEPS   (11)
+#define VMSTAT_COREMAP_ALLOC_FRAG    (12)
+#define VMSTAT_PAGE_EVICT_CLEAN      (13)
+#define VMSTAT_TLB_FAULT_DIRTY       (14)
+#define VMSTAT_SWAP_FILE_WRITE_OPS   (15)
+#define VMSTAT_SWAP_READAHEAD        (16)
+#define VMSTAT_SWAP_READAHEAD_HIT    (17)
+#define VMSTAT_SWAP_READAHEAD_MISS   (18)
+#define VMSTAT_PAGEOUT_WAKEUP        (19)
+#define VMSTAT_PAGEOUT_FREE          (20)
+#define VMSTAT_COW_COPY              (21)
+#define VMSTAT_ELF_FAULT_AROUND      (22)
+#define VMSTAT_PAGE_CACHE_HIT        (23)
+#define VMSTAT_FILE_CACHE_HIT        (24)
+#define VMSTAT_FILE_CACHE_MISS       (25)
+#define VMSTAT_MMAP_FILE_READ        (26)
+#define VMSTAT_MMAP_WRITEBACK        (27)
+#define VMSTAT_TLB_FLUSH_SKIPPED     (28)
+#define VMSTAT_TLB_RESTORE           (29)
+#define VMSTAT_ZERO_POOL_HIT         (30)
+#define VMSTAT_ZERO_POOL_FILL        (31)
+#define VMSTAT_ZSWAP_STORE           (32)
+#define VMSTAT_ZSWAP_HIT             (33)
+#define VMSTAT_ZSWAP_BYTES           (34)
+#define VMSTAT_ZSWAP_FULL            (35)
+#define VMSTAT_WS_EVICT              (36)
+#define VMSTAT_COUNT                 (37)
 
 /* ----------------------------------------------------------------------- */
 
@@ -61,6 +88,24 @@ void _vmstats_init();                    /* atomicity must be ensured elsewhere
 void vmstats_inc(unsigned int index);    /* uses locking */
 void _vmstats_inc(unsigned int index);   /* atomicity must be ensured elsewhere */
 
+/* Add n to the specified count, for stats that are not a number of events
+ * Example use:
+ *   vmstats_add(VMSTAT_ZSWAP_BYTES, len);
+ */
+void vmstats_add(unsigned int index, unsigned int n);    /* uses locking */
+void _vmstats_add(unsigned int index, unsigned int n);   /* atomicity must be ensured elsewhere */
+
+/* TLB faults, zero fills, ELF and swap reads and swap writes are also
+ * counted for the process of the current thread, if it has one.
+ */
+
+/* Record the time a fault took in the fault time histogram, and copy
+ * out the histogram (VMSTAT_NBUCKETS entries, see kern/vmstat.h)
+ * Both turn interrupts off themselves.
+ */
+void vmstats_fault_time(unsigned int usecs);
+void vmstats_get_hist(unsigned int *hist);
+
 /* Print the statistics: assumes that at least vmstats_init has been called */
 void vmstats_print();                    /* uses locking */
 void _vmstats_print();                   /* atomicity must be ensured elsewhere */
@@ -33,7 +33,15 @@ vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
 
 #if OPT_A3
-#define VM_STACKPAGES    12
+#define VM_STACKPAGES    12   // initial size of the user stack region
+#define VM_MAXSTACKPAGES 256  // highest the stack limit can be set (1MB)
+
+// the stack only grows for faults at most this many bytes below the
+// stack pointer
+#define VM_STACKSLACK    256
+
+// mmap places mappings below this, clear of the stack at its largest
+#define VM_MMAPTOP (USERSTACK - VM_MAXSTACKPAGES * PAGE_SIZE)
 #endif // OPT_A3
 
 #endif /* _VM_H_ */
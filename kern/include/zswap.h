@@ -0,0 +1,32 @@
+#ifndef _ZSWAP_H_
+#define _ZSWAP_H_
+
+// Compressed copies of swap slots kept in memory, in front of the
+// swapfile. A page swapped out to a slot is stored here instead of being
+// written out if it compresses to at most half a page, and reading the
+// slot back then needs no I/O. Once the size budget is used up, or
+// kmalloc has nothing left to give, pages go to the swapfile as before.
+//
+// Pages are coded as runs of 32 bit words, either repeats of one word or
+// words stored as they are, which is fast and does well on the zero
+// filled and sparse pages user programs leave behind.
+//
+// zswap_store and zswap_load are called with swap_lock held (see
+// swapfile.c). zswap_drop is called at splhigh when a slot is freed.
+
+// sets the budget to a share of physical memory
+void zswap_bootstrap(void);
+
+// keeps a compressed copy of the page at kernel address page as the
+// contents of slot. returns 0 if it is not kept, and the slot must then
+// be written to the swapfile
+int zswap_store(u_int32_t slot, const void *page);
+// fills the page at kernel address page with the contents of slot.
+// returns 0 if slot is not kept here
+int zswap_load(u_int32_t slot, void *page);
+// whether slot is kept here
+int zswap_contains(u_int32_t slot);
+// forgets slot, which is no longer in use
+void zswap_drop(u_int32_t slot);
+
+#endif // _ZSWAP_H_
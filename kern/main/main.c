@@ -18,6 +18,7 @@
 #include <syscall.h>
 #include <version.h>
 #include <swapfile.h>
+#include <pageout.h>
 #include "opt-A0.h"
 #include "opt-A2.h"
 
@@ -101,6 +102,7 @@ boot(void)
 
 #if OPT_A3
     swapfile_bootstrap();
+    pageout_bootstrap();
 #endif // OPT_A3
 
 	/*
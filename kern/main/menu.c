@@ -14,10 +14,19 @@
 #include <vfs.h>
 #include <sfs.h>
 #include <test.h>
+#include <coremap.h>
+#include <pageout.h>
+#include <pt.h>
+#include <addrspace.h>
+#include <swapfile.h>
+#include <processtable.h>
+#include <kern/vmstat.h>
+#include "uw-vmstats.h"
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 #define _PATH_SHELL "/bin/sh"
 
@@ -372,6 +381,157 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_A3
+/*
+ * Command to show or set the free frame watermarks of the pageout
+ * daemon.
+ */
+static
+int
+cmd_pageout(int nargs, char **args)
+{
+	u_int32_t low, high;
+	int result;
+
+	if (nargs == 3) {
+		result = pageout_set_watermarks(atoi(args[1]), atoi(args[2]));
+		if (result) {
+			kprintf("pw: need low < high <= %u pages\n",
+				coremap_npages());
+			return result;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: pw [low high]\n");
+		return EINVAL;
+	}
+
+	pageout_get_watermarks(&low, &high);
+	kprintf("pageout watermarks: low %u, high %u pages\n", low, high);
+	return 0;
+}
+
+/*
+ * Command to show or set how far the stack of new processes may grow.
+ */
+static
+int
+cmd_stacklimit(int nargs, char **args)
+{
+	if (nargs == 2) {
+		as_set_stack_limit(atoi(args[1]));
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: sl [pages]\n");
+		return EINVAL;
+	}
+
+	kprintf("stack limit: %u pages\n", as_get_stack_limit());
+	return 0;
+}
+
+/*
+ * Command to show or set how many pages are read from the executable
+ * per page fault.
+ */
+static
+int
+cmd_faultaround(int nargs, char **args)
+{
+	if (nargs == 2) {
+		pt_set_fault_around(atoi(args[1]));
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: fa [pages]\n");
+		return EINVAL;
+	}
+
+	kprintf("fault-around: %u pages per ELF read\n", pt_get_fault_around());
+	return 0;
+}
+
+/*
+ * Command to show the swap space, or to swap to a raw disk device
+ * instead of the swapfile. Run it as a boot argument, before anything
+ * has been swapped out.
+ */
+static
+int
+cmd_swap(int nargs, char **args)
+{
+	const char *device;
+	u_int32_t npages;
+	int result;
+
+	if (nargs == 2) {
+		result = swap_set_device(args[1]);
+		if (result) {
+			kprintf("swap: %s: %s\n", args[1], strerror(result));
+			return result;
+		}
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: swap [device]\n");
+		return EINVAL;
+	}
+
+	device = swap_get_device(&npages);
+	kprintf("swap: %s, %u pages\n", device ? device : "swapfile", npages);
+	return 0;
+}
+
+/*
+ * Command to show the paging done by one process, or by all of them,
+ * and how long faults have been taking.
+ */
+static
+int
+cmd_vmstat(int nargs, char **args)
+{
+	struct vmcounts vc;
+	unsigned int hist[VMSTAT_NBUCKETS];
+	int pid, first, last, i;
+
+	if (nargs == 2) {
+		first = last = atoi(args[1]);
+		if (processtable_getvmcounts(first, &vc)) {
+			kprintf("vm: no process %d\n", first);
+			return EINVAL;
+		}
+	}
+	else if (nargs == 1) {
+		first = 0;
+		last = processtable_getsize() - 1;
+	}
+	else {
+		kprintf("Usage: vm [pid]\n");
+		return EINVAL;
+	}
+
+	kprintf("  pid  tlbfaults  zerofills   elfreads  swapreads swapwrites\n");
+	for (pid = first; pid <= last; pid++) {
+		if (processtable_getvmcounts(pid, &vc)) {
+			continue;
+		}
+		kprintf("%5d %10u %10u %10u %10u %10u\n", pid, vc.vc_tlbfaults,
+			vc.vc_zerofills, vc.vc_elfreads, vc.vc_swapreads,
+			vc.vc_swapwrites);
+	}
+
+	vmstats_get_hist(hist);
+	kprintf("fault time:\n");
+	for (i = 0; i < VMSTAT_NBUCKETS; i++) {
+		if (hist[i] > 0) {
+			kprintf("  %s %8u us %10u\n",
+				i < VMSTAT_NBUCKETS - 1 ? "under" : "over ",
+				i < VMSTAT_NBUCKETS - 1 ? 1 << i : 1 << (i - 1),
+				hist[i]);
+		}
+	}
+	return 0;
+}
+#endif /* OPT_A3 */
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -477,6 +637,13 @@ static const char *mainmenu[] = {
 	"[1b] Stoplight                      ",
 #endif
 	"[kh] Kernel heap stats              ",
+#if OPT_A3
+	"[pw] Pageout watermarks             ",
+	"[fa] ELF fault-around pages         ",
+	"[sl] Stack limit                    ",
+	"[swap] Swap device                  ",
+	"[vm] Process VM stats               ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -532,6 +699,13 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+#if OPT_A3
+	{ "pw",         cmd_pageout },
+	{ "fa",         cmd_faultaround },
+	{ "sl",         cmd_stacklimit },
+	{ "swap",       cmd_swap },
+	{ "vm",         cmd_vmstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
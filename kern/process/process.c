@@ -7,7 +7,7 @@
 #include <curthread.h>
 #include <filetable.h>
 #include <synch.h>
-#include <pt.h>
+#include "opt-A3.h"
 
 struct process_table {
 	struct array *process_list;
@@ -44,19 +44,10 @@ struct process * p_create() {
         return NULL;
     }
 
-    // initialize pagetable
-    p->page_table = pt_create();
-    if (p->page_table == NULL) {
-        ft_destroy(p->file_table);
-        kfree(p);
-        return NULL;
-    }
-
     // initiate condition variable for waitpid
     p->p_waitcv = cv_create("proc_cv");
     if (p->p_waitcv == NULL) {
         ft_destroy(p->file_table);
-        pt_destroy(p->page_table);
         kfree(p);
         return NULL;
     }
@@ -65,7 +56,6 @@ struct process * p_create() {
     p->p_lock = lock_create("proc_lock");
     if (p->p_lock == NULL) {
         ft_destroy(p->file_table);
-        pt_destroy(p->page_table);
         cv_destroy(p->p_waitcv);
         kfree(p);
         return NULL;
@@ -75,7 +65,6 @@ struct process * p_create() {
     p->p_childrenpids = array_create();
     if (p->p_childrenpids == NULL) {
         ft_destroy(p->file_table);
-        pt_destroy(p->page_table);
         cv_destroy(p->p_waitcv);
         lock_destroy(p->p_lock);
         kfree(p);
@@ -90,12 +79,13 @@ struct process * p_create() {
     // set explicitly when doing a fork
     p->parentpid = 0;
 
+    bzero(&p->p_vmcounts, sizeof(struct vmcounts));
+
     // insert process to process table
     int err = 0;
     int index = processtable_insert(p, &err);
     if (index == -1) {
         ft_destroy(p->file_table);
-        pt_destroy(p->page_table);
         array_destroy(p->p_childrenpids);
         cv_destroy(p->p_waitcv);
         lock_destroy(p->p_lock);
@@ -113,12 +103,13 @@ struct process * p_create() {
 void p_destroy() {
     struct process *curprocess = get_curprocess();
 
+#if OPT_A3
+    curthread->t_vmcounts = NULL;
+#endif // OPT_A3
+
     // destroy filetable
     ft_destroy(curprocess->file_table);
 
-    // destroy pagetable
-    pt_destroy(curprocess->page_table);
-
     // destroy synch primitives
     lock_destroy(curprocess->p_lock);
     cv_destroy(curprocess->p_waitcv);
@@ -144,9 +135,6 @@ void p_destroy_at(struct process * p) {
     // destroy filetable
     ft_destroy(p->file_table);
 
-    // destroy pagetable
-    pt_destroy(p->page_table);
-
     // destroy synch primitives
     lock_destroy(p->p_lock);
     cv_destroy(p->p_waitcv);
@@ -165,6 +153,12 @@ void p_destroy_at(struct process * p) {
 
 void kill_process(int exitcode) {
     struct process *curprocess = get_curprocess();
+
+#if OPT_A3
+    // the parent may free the process as soon as it knows we exited
+    curthread->t_vmcounts = NULL;
+#endif // OPT_A3
+
 	lock_acquire (curprocess->p_lock);
 
 		curprocess->exitcode = exitcode;
@@ -200,6 +194,9 @@ void kill_process(int exitcode) {
 void p_assign_thread(struct process *p, struct thread *t) {
 	p->p_thread = t;
     t->pid = p->pid;
+#if OPT_A3
+    t->t_vmcounts = &p->p_vmcounts;
+#endif // OPT_A3
 }
 
 struct process* get_curprocess() {
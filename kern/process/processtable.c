@@ -7,6 +7,7 @@
 #include <kern/errno.h>
 #include <kern/limits.h>
 #include <lib.h>
+#include "opt-A3.h"
 
 static struct table *process_table;
 static struct lock *pt_lock;
@@ -64,6 +65,32 @@ struct process * processtable_get(pid_t pid) {
     return p;
 }
 
+#if OPT_A3
+int processtable_getvmcounts(pid_t pid, struct vmcounts *vc) {
+    struct process *p;
+
+    if (pid < 0)
+        return -1;
+
+    // the table lock keeps a waiting parent from freeing the process
+    // until the counters are copied
+    lock_acquire(pt_lock);
+        if (pid >= tab_getsize(process_table)) {
+            lock_release(pt_lock);
+            return -1;
+        }
+        p = (struct process*)tab_getguy(process_table, pid);
+        if (p == NULL) {
+            lock_release(pt_lock);
+            return -1;
+        }
+        *vc = p->p_vmcounts;
+    lock_release(pt_lock);
+
+    return 0;
+}
+#endif // OPT_A3
+
 int processtable_getnum() {
     int ret;
     lock_acquire(pt_lock);
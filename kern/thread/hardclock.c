@@ -3,6 +3,10 @@
 #include <machine/spl.h>
 #include <thread.h>
 #include <clock.h>
+#include "opt-A3.h"
+#if OPT_A3
+#include <pt.h>
+#endif /* OPT_A3 */
 
 /* 
  * The address of lbolt has thread_wakeup called on it once a second.
@@ -22,6 +26,10 @@ hardclock(void)
 	 * Collect statistics here as desired.
 	 */
 
+#if OPT_A3
+	/* sample working sets of the address spaces every few ticks */
+	pt_ws_tick();
+#endif /* OPT_A3 */
 
 	lbolt_counter++;
 	if (lbolt_counter >= HZ) {
@@ -11,6 +11,10 @@
 #include <thread.h>
 #include <machine/spl.h>
 #include <queue.h>
+#include "opt-A3.h"
+#if OPT_A3
+#include <coremap.h>
+#endif // OPT_A3
 
 /*
  *  Scheduler data
@@ -91,6 +95,16 @@ scheduler(void)
 	assert(curspl>0);
 	
 	while (q_empty(runqueue)) {
+#if OPT_A3
+		// zero free pages before going idle, a page at a time.
+		// interrupts that came in while one was zeroed are taken
+		// before the next, the same way cpu_idle takes them
+		if (coremap_prezero()) {
+			spl0();
+			splhigh();
+			continue;
+		}
+#endif // OPT_A3
 		cpu_idle();
 	}
 
@@ -201,6 +201,27 @@ lock_release(struct lock *lock)
     #endif /* OPT_A1 */
 }
 
+int
+lock_tryacquire(struct lock *lock)
+{
+    #if OPT_A1
+        int spl, acquired = 0;
+        assert(lock != NULL);
+
+        spl = splhigh();
+        if (lock->held == NULL) {
+            lock->held = curthread;
+            acquired = 1;
+        }
+        splx(spl);
+
+        return acquired;
+    #else
+        (void)lock;  // suppress warning until code gets written
+        return 1;    // dummy until code gets written
+    #endif /* OPT_A1 */
+}
+
 int
 lock_do_i_hold(struct lock *lock)
 {
@@ -37,6 +37,9 @@ static struct array *zombies;
 /* Total number of outstanding threads. Does not count zombies[]. */
 static int numthreads;
 
+/* Kernel threads that never exit. Not counted by one_thread_only(). */
+static int numdaemons;
+
 /*
  * Create a thread. This is used both to create the first thread's 
  * thread structure and to create subsequent threads.
@@ -59,6 +62,10 @@ thread_create(const char *name)
 	thread->t_stack = NULL;
 	thread->t_vmspace = NULL;
 	thread->t_cwd = NULL;
+#if OPT_A3
+	thread->t_vmcounts = NULL;
+	thread->t_usersp = 0;
+#endif // OPT_A3
 	
 	return thread;
 }
@@ -191,11 +198,19 @@ one_thread_only() {
   /* numthreads is a shared variable, so turn interrupts
      off to ensure that we can inspect its value atomically */
   s = splhigh();
-  n = numthreads;
+  n = numthreads - numdaemons;
   splx(s);
   return(n==1);
 }
 
+void
+thread_count_daemon(void)
+{
+	int s = splhigh();
+	numdaemons++;
+	splx(s);
+}
+
 
 /*
  * Thread initialization.
@@ -238,6 +253,7 @@ thread_bootstrap(void)
 
 	/* Number of threads starts at 1 */
 	numthreads = 1;
+	numdaemons = 0;
 
 	/* Done */
 	return me;
@@ -320,7 +336,9 @@ thread_shutdown(void)
                 p_assign_thread(proc, newguy);
             }
 
-            as_activate(newguy->t_vmspace);
+            // the child's address space is activated when it first runs.
+            // as_copy already dropped the pages it made copy-on-write
+            // from our TLB
         }
     #endif // OPT_A2
 
@@ -474,12 +492,9 @@ mi_switch(threadstate_t nextstate)
 
 	exorcise();
 
-#if OPT_A3
-#else
 	if (curthread->t_vmspace) {
 		as_activate(curthread->t_vmspace);
 	}
-#endif // OPT_A3
 }
 
 /*
@@ -15,6 +15,7 @@
 #include <vfs.h>
 #include <test.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 #if OPT_A2
 #include <process.h>
@@ -114,6 +115,10 @@ int runprogram(char *progname)
         // stack pointer tracker to copy the stack from bottom up
         stackptr -= stack_offset;
         stackptr_tracker = stackptr;
+#if OPT_A3
+        // the arguments go above the stack pointer the program starts with
+        curthread->t_usersp = stackptr;
+#endif // OPT_A3
 
         // copy the number of arguments to user space
         copyout(&argc, (userptr_t)stackptr_tracker, (size_t)argc_size);
@@ -11,6 +11,7 @@
 #include <vm.h>
 #include <vfs.h>
 #include <kern/limits.h>
+#include "opt-A3.h"
 
 // check if program name is invalid
 int program_invalid(const char *program, int *err) {
@@ -165,6 +166,10 @@ int sys_execv(const char *program, char **args, int *err) {
     // stack pointer tracker to copy the stack from bottom up
     stackptr -= stack_offset;
     stackptr_tracker = stackptr;
+#if OPT_A3
+    // the arguments go above the new stack pointer, not the old one
+    curthread->t_usersp = stackptr;
+#endif // OPT_A3
 
     // copy the number of arguments to user space
     copyout(&argc, (userptr_t)stackptr_tracker, argc_size);
@@ -0,0 +1,108 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <lib.h>
+#include <syscall.h>
+#include <file.h>
+#include <filetable.h>
+#include <process.h>
+#include <curthread.h>
+#include <thread.h>
+#include <synch.h>
+#include <vnode.h>
+#include <vm.h>
+#include <addrspace.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+// fd and offset are the fifth and sixth arguments, which the caller
+// passes on its stack at stackargs
+void *sys_mmap(void *addr, size_t len, int prot, int flags,
+               userptr_t stackargs, int *err) {
+    int32_t args[2];
+    int fd, how;
+    off_t offset;
+    struct file *fi;
+    struct vnode *v = NULL;
+    vaddr_t start;
+
+    // there is no MAP_FIXED, the kernel always picks the address
+    (void)addr;
+
+    *err = copyin(stackargs, args, sizeof(args));
+    if (*err) {
+        return MAP_FAILED;
+    }
+    fd = args[0];
+    offset = args[1];
+
+    if (len == 0 || offset < 0 || (offset & ~PAGE_FRAME) != 0 ||
+        (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0) {
+        *err = EINVAL;
+        return MAP_FAILED;
+    }
+
+    // exactly one of MAP_SHARED and MAP_PRIVATE
+    flags &= MAP_SHARED | MAP_PRIVATE | MAP_ANON;
+    if ((flags & (MAP_SHARED | MAP_PRIVATE)) == 0 ||
+        (flags & (MAP_SHARED | MAP_PRIVATE)) == (MAP_SHARED | MAP_PRIVATE)) {
+        *err = EINVAL;
+        return MAP_FAILED;
+    }
+
+    if (!(flags & MAP_ANON)) {
+        fi = ft_getfile(get_curprocess()->file_table, fd, err);
+        if (fi == NULL) {
+            *err = EBADF;
+            return MAP_FAILED;
+        }
+
+        lock_acquire(fi->file_lock);
+        how = fi->status & O_ACCMODE;
+        if (how == O_WRONLY ||
+            ((flags & MAP_SHARED) && (prot & PROT_WRITE) && how != O_RDWR)) {
+            *err = EBADF;
+        }
+        else {
+            *err = VOP_MMAP(fi->v);
+            v = fi->v;
+        }
+        lock_release(fi->file_lock);
+
+        if (*err) {
+            return MAP_FAILED;
+        }
+    }
+
+    *err = as_mmap(curthread->t_vmspace, len, prot, flags, v, offset, &start);
+    if (*err) {
+        return MAP_FAILED;
+    }
+
+    return (void *)start;
+}
+
+int sys_munmap(void *addr, size_t len, int *err) {
+    if (((vaddr_t)addr & ~PAGE_FRAME) != 0) {
+        *err = EINVAL;
+        return -1;
+    }
+
+    *err = as_munmap(curthread->t_vmspace, (vaddr_t)addr, len);
+    return *err ? -1 : 0;
+}
+
+int sys_msync(void *addr, size_t len, int flags, int *err) {
+    // writes are always synchronous and mappings of a file always see
+    // the same pages, so the flags make no difference
+    (void)flags;
+
+    if (((vaddr_t)addr & ~PAGE_FRAME) != 0) {
+        *err = EINVAL;
+        return -1;
+    }
+
+    *err = as_msync(curthread->t_vmspace, (vaddr_t)addr, len);
+    return *err ? -1 : 0;
+}
+#endif // OPT_A3
@@ -17,6 +17,7 @@
 #include <kern/unistd.h>
 #include <vnode.h>
 #include <synch.h>
+#include <pagecache.h>
 
 int sys_read(int fd, userptr_t buf, size_t buflen,  int *err) {
     struct process *curprocess = processtable_get(curthread->pid);
@@ -78,7 +79,7 @@ int sys_read(int fd, userptr_t buf, size_t buflen,  int *err) {
     u.uio_segflg = UIO_USERSPACE;
     u.uio_space = curthread->t_vmspace;
 
-    result = VOP_READ(file->v, &u);
+    result = pagecache_read(file->v, &u);
     if (result !=0) {
         goto fail;
     }
@@ -0,0 +1,20 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <syscall.h>
+#include <curthread.h>
+#include <thread.h>
+#include <addrspace.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+void *sys_sbrk(intptr_t amount, int *err) {
+    vaddr_t oldtop;
+
+    *err = as_sbrk(curthread->t_vmspace, amount, &oldtop);
+    if (*err) {
+        return (void *)-1;
+    }
+
+    return (void *)oldtop;
+}
+#endif // OPT_A3
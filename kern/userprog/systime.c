@@ -0,0 +1,31 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <syscall.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+time_t sys___time(userptr_t seconds, userptr_t nanoseconds, int *err) {
+    time_t secs;
+    u_int32_t nsecs;
+
+    gettime(&secs, &nsecs);
+
+    // either pointer may be NULL
+    if (seconds != NULL) {
+        *err = copyout(&secs, seconds, sizeof(time_t));
+        if (*err) {
+            return -1;
+        }
+    }
+    if (nanoseconds != NULL) {
+        *err = copyout(&nsecs, nanoseconds, sizeof(u_int32_t));
+        if (*err) {
+            return -1;
+        }
+    }
+
+    return secs;
+}
+#endif // OPT_A3
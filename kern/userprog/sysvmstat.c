@@ -0,0 +1,37 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/vmstat.h>
+#include <lib.h>
+#include <syscall.h>
+#include <processtable.h>
+#include "opt-A3.h"
+#include "uw-vmstats.h"
+
+#if OPT_A3
+int sys_vmstat(pid_t pid, userptr_t counts, userptr_t hist, int *err) {
+    struct vmcounts vc;
+    unsigned int h[VMSTAT_NBUCKETS];
+
+    // either pointer may be NULL
+    if (counts != NULL) {
+        if (processtable_getvmcounts(pid, &vc)) {
+            *err = EINVAL;
+            return -1;
+        }
+
+        *err = copyout(&vc, counts, sizeof(struct vmcounts));
+        if (*err) {
+            return -1;
+        }
+    }
+    if (hist != NULL) {
+        vmstats_get_hist(h);
+        *err = copyout(h, hist, sizeof(h));
+        if (*err) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+#endif // OPT_A3
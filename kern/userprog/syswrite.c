@@ -16,6 +16,7 @@
 #include <machine/spl.h>
 #include <kern/errno.h>
 #include <vm.h>
+#include <pagecache.h>
 
 // TODO ENOSPC	There is no free space remaining on the filesystem containing the file.
 // TODO EIO	A hardware I/O error occurred writing the data.
@@ -70,7 +71,7 @@ int sys_write(int fd, void *buf, size_t buflen, int *err) {
         u.uio_offset = fi->offset;
 
         // write to file
-        result = VOP_WRITE(fi->v, &u);
+        result = pagecache_write(fi->v, &u);
         if (*err !=0) {
             goto fail;
         }
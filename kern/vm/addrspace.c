@@ -1,5 +1,6 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/unistd.h>
 #include <lib.h>
 #include <thread.h>
 #include <curthread.h>
@@ -22,6 +23,11 @@
  * used. The cheesy hack versions in dumbvm.c are used instead.
  */
 
+#if OPT_A3
+// stack limit, in pages, of new address spaces
+static u_int32_t stack_limit = VM_MAXSTACKPAGES;
+#endif // OPT_A3
+
 struct addrspace * as_create(void) {
 	struct addrspace *as = kmalloc(sizeof(struct addrspace));
 	if (as==NULL) {
@@ -42,7 +48,20 @@ struct addrspace * as_create(void) {
     as->as_offset2 = 0;
     as->as_flags2 = 0;
 
-    as->as_stackpbase = 0;
+    as->as_heapbase = 0;
+    as->as_heaptop = 0;
+
+    // the stack is demand paged, so it costs nothing until it is touched
+    as->as_stackbase = USERSTACK - VM_STACKPAGES * PAGE_SIZE;
+    as->as_stacklimit = stack_limit;
+
+    as->as_mmaps = NULL;
+
+    as->as_pt = pt_create();
+    if (as->as_pt == NULL) {
+        kfree(as);
+        return NULL;
+    }
 #endif // OPT_A3
 
 	return as;
@@ -51,6 +70,9 @@ struct addrspace * as_create(void) {
 int
 as_copy(struct addrspace *old, struct addrspace **ret) {
 	struct addrspace *newas;
+#if OPT_A3
+    struct mmap_region *mr, *copy, **tail;
+#endif // OPT_A3
 
 	newas = as_create();
 	if (newas==NULL) {
@@ -58,7 +80,50 @@ as_copy(struct addrspace *old, struct addrspace **ret) {
 	}
 
 #if OPT_A3
-    (void)old;
+    newas->as_vnode = old->as_vnode;
+    if (newas->as_vnode != NULL) {
+        VOP_INCREF(newas->as_vnode);
+    }
+
+    newas->as_vbase1 = old->as_vbase1;
+    newas->as_npages1 = old->as_npages1;
+    newas->as_filesz1 = old->as_filesz1;
+    newas->as_offset1 = old->as_offset1;
+    newas->as_flags1 = old->as_flags1;
+
+    newas->as_vbase2 = old->as_vbase2;
+    newas->as_npages2 = old->as_npages2;
+    newas->as_filesz2 = old->as_filesz2;
+    newas->as_offset2 = old->as_offset2;
+    newas->as_flags2 = old->as_flags2;
+
+    newas->as_heapbase = old->as_heapbase;
+    newas->as_heaptop = old->as_heaptop;
+    newas->as_stackbase = old->as_stackbase;
+    newas->as_stacklimit = old->as_stacklimit;
+
+    // mappings keep their place in the list, so it stays sorted
+    tail = &newas->as_mmaps;
+    for (mr = old->as_mmaps; mr != NULL; mr = mr->mr_next) {
+        copy = kmalloc(sizeof(struct mmap_region));
+        if (copy == NULL) {
+            as_destroy(newas);
+            return ENOMEM;
+        }
+        *copy = *mr;
+        copy->mr_next = NULL;
+        if (copy->mr_vnode != NULL) {
+            VOP_INCREF(copy->mr_vnode);
+        }
+        *tail = copy;
+        tail = &copy->mr_next;
+    }
+
+    // pages are shared copy-on-write
+    if (pt_copy(old->as_pt, newas->as_pt)) {
+        as_destroy(newas);
+        return ENOMEM;
+    }
 #else
 	(void)old;
 #endif // OPT_A3
@@ -70,8 +135,22 @@ as_copy(struct addrspace *old, struct addrspace **ret) {
 void
 as_destroy(struct addrspace *as)
 {
-    VOP_DECREF(as->as_vnode);
-    ungetppages(as->as_stackpbase);
+    struct mmap_region *mr;
+
+    // modified pages of shared mappings are written back on the way, so
+    // the vnodes must outlive the page table
+    pt_destroy(as->as_pt);
+    if (as->as_vnode != NULL) {
+        VOP_DECREF(as->as_vnode);
+    }
+    while (as->as_mmaps != NULL) {
+        mr = as->as_mmaps;
+        as->as_mmaps = mr->mr_next;
+        if (mr->mr_vnode != NULL) {
+            VOP_DECREF(mr->mr_vnode);
+        }
+        kfree(mr);
+    }
 	kfree(as);
 }
 
@@ -79,19 +158,10 @@ void
 as_activate(struct addrspace *as)
 {
 #if OPT_A3
-	int i, spl;
-
-	(void)as;
-
-	spl = splhigh();
-
-    _vmstats_inc(VMSTAT_TLB_INVALIDATE);
-    // invalidate TLB
-	for (i=0; i<NUM_TLB; i++) {
-		TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-	}
-
-	splx(spl);
+    // kernel threads leave the TLB to whoever had it
+    if (as != NULL) {
+        pt_activate(as->as_pt);
+    }
 #else
 	(void)as;  // suppress warning until code gets written
 #endif // OPT_A3
@@ -139,6 +209,12 @@ int as_define_region(struct addrspace *as,
     VOP_INCREF(v);
     VOP_INCREF(v);
 
+    // the heap starts right after the highest segment
+    if (vaddr + sz > as->as_heapbase) {
+        as->as_heapbase = vaddr + sz;
+        as->as_heaptop = as->as_heapbase;
+    }
+
 	if (as->as_vbase1 == 0) {
         as->as_vnode = v;
 		as->as_vbase1 = vaddr;
@@ -178,14 +254,7 @@ int as_define_region(struct addrspace *as,
 int
 as_prepare_load(struct addrspace *as)
 {
-#if OPT_A3
-    as->as_stackpbase = getppages(VM_STACKPAGES);
-    if (as->as_stackpbase == 0) {
-        return ENOMEM;
-    }
-#else
 	(void)as;
-#endif // OPT_A3
 	return 0;
 }
 
@@ -199,11 +268,7 @@ as_complete_load(struct addrspace *as)
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-#if OPT_A3
-    assert(as->as_stackpbase != 0);
-#else
 	(void)as;
-#endif
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -214,17 +279,20 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 #if OPT_A3
 int as_contains(struct addrspace *as, vaddr_t vaddr) {
     vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+    vaddr_t heapbase, heaptop;
+    struct mmap_region *mr;
 
 	vbase1 = as->as_vbase1;
 	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
 	vbase2 = as->as_vbase2;
 	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
-    stackbase = USERSTACK - VM_STACKPAGES * PAGE_SIZE;
+    stackbase = as->as_stackbase;
     stacktop = USERSTACK;
+    heapbase = as->as_heapbase;
+    heaptop = ROUNDUP(as->as_heaptop, PAGE_SIZE);
 
     assert(vbase1 != 0);
     assert(vbase2 != 0);
-    assert(as->as_stackpbase != 0);
 
     if (vaddr >= vbase1 && vaddr < vtop1)
         return SEG_TEXT;
@@ -232,6 +300,15 @@ int as_contains(struct addrspace *as, vaddr_t vaddr) {
         return SEG_DATA;
     else if (vaddr >= stackbase && vaddr < stacktop)
         return SEG_STCK;
+    else if (vaddr >= heapbase && vaddr < heaptop)
+        return SEG_HEAP;
+    else if (vaddr >= VM_MMAPTOP)
+        return 0;
+
+    // PROT_NONE mappings cannot be touched at all
+    mr = as_find_mmap(as, vaddr);
+    if (mr != NULL && mr->mr_prot != PROT_NONE)
+        return SEG_MMAP;
 
     return 0;
 }
@@ -246,11 +323,208 @@ int as_writeable(struct addrspace *as, vaddr_t vaddr) {
         flags = as->as_flags1;
     else if (seg == SEG_DATA)
         flags = as->as_flags2;
-    else if (seg == SEG_STCK)
+    else if (seg == SEG_STCK || seg == SEG_HEAP)
         flags = SEG_WR;
+    else if (seg == SEG_MMAP)
+        flags = as_find_mmap(as, vaddr)->mr_prot & PROT_WRITE ? SEG_WR : 0;
     else
         return 0;
 
     return flags & SEG_WR;
 }
+
+// returns the lowest address mapped by mmap, VM_MMAPTOP if there is none
+static vaddr_t as_mmap_floor(struct addrspace *as) {
+    struct mmap_region *mr = as->as_mmaps;
+
+    if (mr == NULL) {
+        return VM_MMAPTOP;
+    }
+    while (mr->mr_next != NULL) {
+        mr = mr->mr_next;
+    }
+    return mr->mr_start;
+}
+
+int as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldtop) {
+    vaddr_t newtop;
+
+    *oldtop = as->as_heaptop;
+    newtop = as->as_heaptop + amount;
+
+    if (amount < 0 && (newtop < as->as_heapbase || newtop > *oldtop)) {
+        return EINVAL;
+    }
+    // leave room for the stack to grow to its limit, and for mappings
+    if (amount > 0 && (newtop < *oldtop ||
+        ROUNDUP(newtop, PAGE_SIZE) > as_mmap_floor(as))) {
+        return ENOMEM;
+    }
+
+    if (ROUNDUP(newtop, PAGE_SIZE) < ROUNDUP(*oldtop, PAGE_SIZE)) {
+        pt_unmap(as->as_pt, ROUNDUP(newtop, PAGE_SIZE),
+                 ROUNDUP(*oldtop, PAGE_SIZE));
+    }
+    as->as_heaptop = newtop;
+
+    return 0;
+}
+
+int as_grow_stack(struct addrspace *as, vaddr_t vaddr, vaddr_t sp) {
+    vaddr_t limit, vtop1, vtop2;
+
+    // programs only use the stack above the stack pointer, anything
+    // further down is a stray pointer
+    if (vaddr + VM_STACKSLACK < sp) {
+        return 0;
+    }
+
+    vaddr &= PAGE_FRAME;
+    limit = USERSTACK - as->as_stacklimit * PAGE_SIZE;
+    vtop1 = as->as_vbase1 + as->as_npages1 * PAGE_SIZE;
+    vtop2 = as->as_vbase2 + as->as_npages2 * PAGE_SIZE;
+
+    if (vaddr >= as->as_stackbase || vaddr < limit ||
+        vaddr < vtop1 || vaddr < vtop2 ||
+        vaddr < ROUNDUP(as->as_heaptop, PAGE_SIZE)) {
+        return 0;
+    }
+
+    as->as_stackbase = vaddr;
+    return SEG_STCK;
+}
+
+void as_set_stack_limit(u_int32_t npages) {
+    if (npages < VM_STACKPAGES) {
+        npages = VM_STACKPAGES;
+    }
+    if (npages > VM_MAXSTACKPAGES) {
+        npages = VM_MAXSTACKPAGES;
+    }
+    stack_limit = npages;
+}
+
+u_int32_t as_get_stack_limit(void) {
+    return stack_limit;
+}
+
+struct mmap_region *as_find_mmap(struct addrspace *as, vaddr_t vaddr) {
+    struct mmap_region *mr;
+
+    for (mr = as->as_mmaps; mr != NULL; mr = mr->mr_next) {
+        if (vaddr >= mr->mr_start + mr->mr_npages * PAGE_SIZE) {
+            // sorted highest first, nothing further down can hold it
+            return NULL;
+        }
+        if (vaddr >= mr->mr_start) {
+            return mr;
+        }
+    }
+    return NULL;
+}
+
+int as_mmap(struct addrspace *as, size_t len, int prot, int flags,
+            struct vnode *v, u_int32_t offset, vaddr_t *addr) {
+    vaddr_t top, floor;
+    size_t size;
+    struct mmap_region *mr, **pp;
+
+    if (len == 0 || len > VM_MMAPTOP) {
+        return EINVAL;
+    }
+    size = ROUNDUP(len, PAGE_SIZE);
+    floor = ROUNDUP(as->as_heaptop, PAGE_SIZE);
+
+    // first gap from the top that is big enough
+    top = VM_MMAPTOP;
+    for (pp = &as->as_mmaps; *pp != NULL; pp = &(*pp)->mr_next) {
+        if (top - ((*pp)->mr_start + (*pp)->mr_npages * PAGE_SIZE) >= size) {
+            break;
+        }
+        top = (*pp)->mr_start;
+    }
+    if (top < floor || top - floor < size) {
+        return ENOMEM;
+    }
+
+    mr = kmalloc(sizeof(struct mmap_region));
+    if (mr == NULL) {
+        return ENOMEM;
+    }
+    mr->mr_start = top - size;
+    mr->mr_npages = size / PAGE_SIZE;
+    mr->mr_prot = prot;
+    mr->mr_flags = flags;
+    mr->mr_vnode = v;
+    mr->mr_offset = offset;
+    mr->mr_next = *pp;
+    *pp = mr;
+
+    if (v != NULL) {
+        VOP_INCREF(v);
+    }
+
+    *addr = mr->mr_start;
+    return 0;
+}
+
+// whether modified pages of mr go back to its file
+static int as_mmap_shared(struct mmap_region *mr) {
+    return mr->mr_vnode != NULL && (mr->mr_flags & MAP_SHARED);
+}
+
+int as_munmap(struct addrspace *as, vaddr_t addr, size_t len) {
+    struct mmap_region *mr, **pp;
+    vaddr_t end;
+    int err = 0;
+
+    for (pp = &as->as_mmaps; *pp != NULL; pp = &(*pp)->mr_next) {
+        if ((*pp)->mr_start == addr) {
+            break;
+        }
+    }
+    mr = *pp;
+    if (mr == NULL || ROUNDUP(len, PAGE_SIZE) != mr->mr_npages * PAGE_SIZE) {
+        return EINVAL;
+    }
+    end = mr->mr_start + mr->mr_npages * PAGE_SIZE;
+
+    if (as_mmap_shared(mr)) {
+        err = pt_msync(as->as_pt, mr->mr_start, end);
+    }
+    pt_unmap(as->as_pt, mr->mr_start, end);
+
+    *pp = mr->mr_next;
+    if (mr->mr_vnode != NULL) {
+        VOP_DECREF(mr->mr_vnode);
+    }
+    kfree(mr);
+
+    return err;
+}
+
+int as_msync(struct addrspace *as, vaddr_t addr, size_t len) {
+    struct mmap_region *mr;
+    vaddr_t start, end, mrend;
+    int err;
+
+    end = addr + ROUNDUP(len, PAGE_SIZE);
+    if (end < addr) {
+        return EINVAL;
+    }
+
+    for (mr = as->as_mmaps; mr != NULL; mr = mr->mr_next) {
+        mrend = mr->mr_start + mr->mr_npages * PAGE_SIZE;
+        if (!as_mmap_shared(mr) || mrend <= addr || mr->mr_start >= end) {
+            continue;
+        }
+        start = mr->mr_start > addr ? mr->mr_start : addr;
+        err = pt_msync(as->as_pt, start, mrend < end ? mrend : end);
+        if (err) {
+            return err;
+        }
+    }
+
+    return 0;
+}
 #endif // OPT_A3
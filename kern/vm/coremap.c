@@ -4,63 +4,216 @@
 #include <thread.h>
 #include <curthread.h>
 #include <coremap.h>
+#include <pageout.h>
+#include <pagecache.h>
 #include <vm.h>
 #include <addrspace.h>
+#include <pt.h>
 #include <uio.h>
 #include <machine/spl.h>
 #include <machine/tlb.h>
+#include "uw-vmstats.h"
 
 
 static u_int32_t cm_size;
 static paddr_t firstaddr;
 static paddr_t lastaddr;
-static paddr_t freeaddr; 
 static u_int32_t cm_bootstrapped = 0;
-static struct coremap_entry ** cm;
+static struct coremap_entry *cm;
 
+// frames are identified by their index in the coremap
+#define CM_PADDR(i) (firstaddr + (i) * PAGE_SIZE)
+#define CM_INDEX(paddr) (((paddr) - firstaddr) / PAGE_SIZE)
+
+// buddy allocator state. free_lists[k] holds the index of the first
+// free block of 2^k pages. Blocks are aligned relative to firstaddr.
+static int free_lists[CM_NORDERS];
+static u_int32_t free_count[CM_NORDERS];
+static u_int32_t cm_nfree;
+
+// position of the clock hand for page replacement
+static u_int32_t clock_hand = 0;
+
+// frames zeroed ahead of time while the cpu had nothing to run, linked
+// through next. they are allocated as far as the buddy allocator knows,
+// but count as free and go back to it before anything else when it runs dry
+#define CM_ZERO_POOL 32
+static u_int32_t zero_pool = CM_NO_LINK;
+static u_int32_t zero_count = 0;
+
+
+static void freelist_push(u_int32_t index, int order) {
+    cm[index].order = order;
+    cm[index].prev = CM_NO_LINK;
+    cm[index].next = free_lists[order];
+    if (free_lists[order] != CM_NO_LINK) {
+        cm[free_lists[order]].prev = index;
+    }
+    free_lists[order] = index;
+    free_count[order]++;
+}
+
+static void freelist_remove(u_int32_t index) {
+    int order = cm[index].order;
+    assert(order != CM_NOT_HEAD);
+
+    if (cm[index].prev != CM_NO_LINK) {
+        cm[cm[index].prev].next = cm[index].next;
+    }
+    else {
+        free_lists[order] = cm[index].next;
+    }
+    if (cm[index].next != CM_NO_LINK) {
+        cm[cm[index].next].prev = cm[index].prev;
+    }
+
+    cm[index].order = CM_NOT_HEAD;
+    cm[index].next = CM_NO_LINK;
+    cm[index].prev = CM_NO_LINK;
+    free_count[order]--;
+}
+
+// returns the free block of 2^order pages at index to the allocator,
+// merging it with its buddy for as long as the buddy is free too
+static void buddy_free_block(u_int32_t index, int order) {
+    u_int32_t buddy;
+
+    while (order < CM_NORDERS - 1) {
+        buddy = index ^ (1 << order);
+        if (buddy + (1 << order) > cm_size || cm[buddy].order != order) {
+            break;
+        }
+        freelist_remove(buddy);
+        if (buddy < index) {
+            index = buddy;
+        }
+        order++;
+    }
+
+    freelist_push(index, order);
+}
+
+// frees npages starting at index by splitting the run into the largest
+// aligned power-of-two blocks it contains
+static void buddy_free_range(u_int32_t index, u_int32_t npages) {
+    u_int32_t i;
+    int order;
+
+    for (i = index; i < index + npages; i++) {
+        cm[i].use = 0;
+        cm[i].tail = 0;
+        cm[i].ref = 0;
+        cm[i].readahead = 0;
+        cm[i].refcount = 0;
+        cm[i].owner = NULL;
+        cm[i].swapslot = CM_NO_SWAPSLOT;
+    }
+    cm_nfree += npages;
+
+    while (npages > 0) {
+        order = 0;
+        while (order < CM_NORDERS - 1 &&
+               (index & ((1 << (order + 1)) - 1)) == 0 &&
+               (u_int32_t)(1 << (order + 1)) <= npages) {
+            order++;
+        }
+        buddy_free_block(index, order);
+        index += 1 << order;
+        npages -= 1 << order;
+    }
+}
 
 void coremap_bootstrap() {
     u_int32_t i = 0;
-    struct coremap_entry *cm_entry;
+    u_int32_t cm_pages;
+    paddr_t cm_paddr;
 
     // figure out how much RAM we have to work with
     ram_getsize(&firstaddr, &lastaddr);
-    cm_size = (lastaddr - firstaddr) / PAGE_SIZE;
 
-    // create core map    
-    cm = kmalloc(sizeof (struct coremap_entry*) * cm_size);
-    if (cm == NULL) {
+    // steal enough pages to describe all of it. the coremap itself is
+    // never freed, so it does not need an entry of its own
+    cm_pages = DIVROUNDUP(((lastaddr - firstaddr) / PAGE_SIZE) *
+            sizeof(struct coremap_entry), PAGE_SIZE);
+    cm_paddr = ram_stealmem(cm_pages);
+    if (cm_paddr == 0) {
         panic("Coremap could not be allocated");
         return;
     }
+    cm = (struct coremap_entry *)PADDR_TO_KVADDR(cm_paddr);
+
+    // everything after the coremap is ours to manage
+    ram_getsize(&firstaddr, &lastaddr);
+    cm_size = (lastaddr - firstaddr) / PAGE_SIZE;
 
-    // instantiate all possible entries on the coremap
     for (i = 0; i < cm_size; i++) {
-        cm_entry = kmalloc(sizeof ( struct coremap_entry ));
-        if (cm_entry == NULL) {
-            panic("Coremap entry could not be allocated");
-            return;
-        }
-        cm_entry->size = 0;
-        cm_entry->use = 0;
-        cm_entry->paddr = (PAGE_SIZE * i) + firstaddr;
-        cm[i] = cm_entry;
+        cm[i].use = 1;
+        cm[i].tail = 0;
+        cm[i].order = CM_NOT_HEAD;
+        cm[i].next = CM_NO_LINK;
+        cm[i].prev = CM_NO_LINK;
+        cm[i].ref = 0;
+        cm[i].readahead = 0;
+        cm[i].refcount = 0;
+        cm[i].owner = NULL;
+        cm[i].vpn = 0;
+        cm[i].swapslot = CM_NO_SWAPSLOT;
     }
 
-    // update our addresses to figure out 
-    ram_getsize(&freeaddr, &lastaddr);
+    // hand every frame to the buddy allocator
+    for (i = 0; i < CM_NORDERS; i++) {
+        free_lists[i] = CM_NO_LINK;
+        free_count[i] = 0;
+    }
+    cm_nfree = 0;
+    buddy_free_range(0, cm_size);
 
-    // make all phys addr before our free addr fixed so that 
-    // structures needed for the OS are ensured not to be removed
-    for (i = 0; i < cm_size; i++) {
-        if (cm[i]->paddr >= freeaddr) {
+    cm_bootstrapped = 1;
+}
+
+// takes a block of 2^want pages off the free lists, splitting a larger
+// one if needed. returns its first index, CM_NO_LINK if there is none
+static u_int32_t buddy_alloc(int want) {
+    u_int32_t index;
+    int order;
+
+    for (order = want; order < CM_NORDERS; order++) {
+        _vmstats_inc(VMSTAT_COREMAP_ALLOC_STEPS);
+        if (free_lists[order] != CM_NO_LINK) {
             break;
         }
-        cm[i]->size = -1;
-        cm[i]->use = 1;
+    }
+    if (order >= CM_NORDERS) {
+        return CM_NO_LINK;
     }
 
-    cm_bootstrapped = 1;
+    index = free_lists[order];
+    freelist_remove(index);
+
+    // split the block down to the size we want, giving the upper
+    // halves back to the lower order lists
+    while (order > want) {
+        order--;
+        _vmstats_inc(VMSTAT_COREMAP_ALLOC_STEPS);
+        freelist_push(index + (1 << order), order);
+    }
+
+    cm_nfree -= 1 << want;
+    return index;
+}
+
+// gives one pre-zeroed frame back to the buddy allocator. returns 0 if
+// the pool is empty
+static int zero_pool_drain(void) {
+    u_int32_t index = zero_pool;
+
+    if (index == CM_NO_LINK) {
+        return 0;
+    }
+    zero_pool = cm[index].next;
+    zero_count--;
+    buddy_free_range(index, 1);
+    return 1;
 }
 
 paddr_t getppages(unsigned long npages) {
@@ -78,70 +231,361 @@ paddr_t getppages(unsigned long npages) {
 	}
     // ======================================================
 
-    u_int32_t cont_count = npages; // counts contiguous pages
-    u_int32_t cont_block_index; // index of the contiguous block
+    u_int32_t index;
     u_int32_t i = 0;
+    int want = 0;
 
-    // iterate through the coremap to find a contiguous block
-    // to hold npages
-    for (i = 0; i <= cm_size; i++) {
-        if (cont_count == 0) {
-            cont_block_index = i - npages;
-            break;
-        }
-        else if (cm[i]->use == 0) {
-            cont_count--;
-        }
-        else if (i == cm_size -1) {
-        	// TODO what if we dont find a block big enough?
-            splx(spl);
-            return 0;        
-        }
-        else {
-            cont_count = npages;
-        }
+    _vmstats_inc(VMSTAT_COREMAP_ALLOC);
+
+    // smallest block that can hold npages
+    while (want < CM_NORDERS && (u_int32_t)(1 << want) < npages) {
+        want++;
     }
 
-    if (cont_count != 0) {
+    // find the smallest free block that fits, giving up pre-zeroed frames
+    // and then idle page cache frames until there is one
+    do {
+        index = buddy_alloc(want);
+    } while (index == CM_NO_LINK &&
+             (zero_pool_drain() || pagecache_reclaim()));
+
+    if (index == CM_NO_LINK) {
+        if (cm_nfree >= npages) {
+            // enough memory, just not in one piece
+            _vmstats_inc(VMSTAT_COREMAP_ALLOC_FRAG);
+        }
         splx(spl);
         return 0;
     }
-	
-	// set the first page of the block
-    addr = cm[cont_block_index]->paddr;
-    cm[cont_block_index]->use = 1;
-    cm[cont_block_index]->size = npages;
 
-	struct uio ku;
-	mk_kuio(&ku, (void*)PADDR_TO_KVADDR(addr), PAGE_SIZE*npages, 0, UIO_READ);
-	ku.uio_resid = PAGE_SIZE*npages;
-	uiomovezeros(PAGE_SIZE*npages,&ku);
+    // return the unused tail of the block (if npages is not a power of two)
+    if ((u_int32_t)(1 << want) > npages) {
+        buddy_free_range(index + npages, (1 << want) - npages);
+    }
+
+	// set the first page of the block
+    addr = CM_PADDR(index);
+    cm[index].use = 1;
+    cm[index].tail = 0;
 
 	// set the "tail" of the block of pages to be in use
-	for (i = cont_block_index+1; i < cont_block_index + npages; i++) {
-	    cm[i]->use = 1;
-	    cm[i]->size = -1;
+	for (i = index+1; i < index + npages; i++) {
+	    cm[i].use = 1;
+	    cm[i].tail = 1;
 	}
-	
+
+    // start reclaiming in the background before we run out
+    pageout_check(cm_nfree + zero_count);
+
 	splx(spl);
 	return addr;
 }
 
+paddr_t getzeroedpage() {
+    int spl;
+    u_int32_t index;
+    paddr_t addr;
+
+    spl = splhigh();
+    if (zero_pool != CM_NO_LINK) {
+        index = zero_pool;
+        zero_pool = cm[index].next;
+        zero_count--;
+        _vmstats_inc(VMSTAT_ZERO_POOL_HIT);
+        pageout_check(cm_nfree + zero_count);
+        splx(spl);
+        return CM_PADDR(index);
+    }
+    splx(spl);
+
+    addr = getppages(1);
+    if (addr != 0) {
+        bzero((void *)PADDR_TO_KVADDR(addr), PAGE_SIZE);
+    }
+    return addr;
+}
+
+int coremap_prezero() {
+    u_int32_t index, low, high;
+
+    assert(curspl > 0);
+
+    if (!cm_bootstrapped || zero_count >= CM_ZERO_POOL) {
+        return 0;
+    }
+
+    // leave the frames the pageout daemon is working to keep free alone
+    pageout_get_watermarks(&low, &high);
+    if (cm_nfree <= high) {
+        return 0;
+    }
+
+    index = buddy_alloc(0);
+    if (index == CM_NO_LINK) {
+        return 0;
+    }
+    cm[index].use = 1;
+    cm[index].tail = 0;
+    bzero((void *)PADDR_TO_KVADDR(CM_PADDR(index)), PAGE_SIZE);
+
+    cm[index].next = zero_pool;
+    zero_pool = index;
+    zero_count++;
+    _vmstats_inc(VMSTAT_ZERO_POOL_FILL);
+    return 1;
+}
+
 
 void ungetppages(paddr_t paddr) {
     int spl;
-    u_int32_t i = 0;
+    u_int32_t index, npages;
+
+    // pages stolen before the coremap existed can never be given back
+    if (paddr < firstaddr) {
+        return;
+    }
 
     spl = splhigh();
 
     // calculate index of the addr
-    u_int32_t index = (paddr - firstaddr) / PAGE_SIZE;
+    index = CM_INDEX(paddr);
+
+    // must be the head of an allocated block
+    assert(index < cm_size);
+    assert(cm[index].use == 1 && cm[index].tail == 0);
+
+    // the block runs until the next frame that is not one of its tails
+    npages = 1;
+    while (index + npages < cm_size && cm[index + npages].tail) {
+        npages++;
+    }
 
     // make the phys addr available on the coremap
-    for (i = index + cm[index]->size -1; i >= index; i--) {
-        cm[i]->use = 0;
-        cm[i]->size = 0;
+    buddy_free_range(index, npages);
+    pageout_freed();
+    pt_evict_wakeup();
+
+    splx(spl);
+}
+
+void coremap_set_owner(paddr_t paddr, struct pagetable *pt, vaddr_t vaddr) {
+    int spl;
+    u_int32_t index = CM_INDEX(paddr);
+
+    spl = splhigh();
+    assert(index < cm_size && cm[index].use == 1);
+    cm[index].owner = pt;
+    cm[index].vpn = vaddr >> 12;
+    cm[index].ref = 1;
+    cm[index].refcount = 1;
+    splx(spl);
+}
+
+int coremap_share(paddr_t paddr) {
+    int spl, shared = 0;
+    u_int32_t index = CM_INDEX(paddr);
+
+    spl = splhigh();
+    assert(index < cm_size && cm[index].use == 1 && cm[index].refcount > 0);
+    if (cm[index].refcount < CM_MAX_REFCOUNT) {
+        cm[index].refcount++;
+        shared = 1;
+    }
+    splx(spl);
+    return shared;
+}
+
+u_int32_t coremap_unshare(paddr_t paddr, struct pagetable *pt) {
+    int spl;
+    u_int32_t left, index = CM_INDEX(paddr);
+
+    spl = splhigh();
+    assert(index < cm_size && cm[index].use == 1 && cm[index].refcount > 0);
+    cm[index].refcount--;
+    if (cm[index].owner == pt) {
+        // whoever is left claims it on their next fault
+        cm[index].owner = NULL;
+    }
+    left = cm[index].refcount;
+    splx(spl);
+    return left;
+}
+
+u_int32_t coremap_refcount(paddr_t paddr) {
+    u_int32_t index = CM_INDEX(paddr);
+    assert(index < cm_size);
+    return cm[index].refcount;
+}
+
+void coremap_claim(paddr_t paddr, struct pagetable *pt, vaddr_t vaddr) {
+    int spl;
+    u_int32_t index = CM_INDEX(paddr);
+
+    spl = splhigh();
+    assert(index < cm_size && cm[index].use == 1);
+    if (cm[index].refcount == 1 && cm[index].owner == NULL) {
+        cm[index].owner = pt;
+        cm[index].vpn = vaddr >> 12;
+    }
+    splx(spl);
+}
+
+// the fields are bitfields sharing words with the allocator's, so even
+// single field updates happen at splhigh
+
+void coremap_set_referenced(paddr_t paddr) {
+    int spl;
+    u_int32_t index = CM_INDEX(paddr);
+    assert(index < cm_size);
+    spl = splhigh();
+    cm[index].ref = 1;
+    splx(spl);
+}
+
+void coremap_set_swapslot(paddr_t paddr, u_int32_t slot) {
+    int spl;
+    u_int32_t index = CM_INDEX(paddr);
+    assert(index < cm_size && cm[index].use == 1);
+    spl = splhigh();
+    cm[index].swapslot = slot;
+    splx(spl);
+}
+
+u_int32_t coremap_get_swapslot(paddr_t paddr) {
+    u_int32_t index = CM_INDEX(paddr);
+    assert(index < cm_size);
+    return cm[index].swapslot;
+}
+
+void coremap_set_readahead(paddr_t paddr) {
+    int spl;
+    u_int32_t index = CM_INDEX(paddr);
+    assert(index < cm_size && cm[index].use == 1);
+    spl = splhigh();
+    cm[index].readahead = 1;
+    cm[index].ref = 0;
+    splx(spl);
+}
+
+int coremap_take_readahead(paddr_t paddr) {
+    int spl;
+    u_int32_t index = CM_INDEX(paddr);
+    int readahead;
+
+    assert(index < cm_size);
+    spl = splhigh();
+    readahead = cm[index].readahead;
+    cm[index].readahead = 0;
+    splx(spl);
+    return readahead;
+}
+
+paddr_t coremap_clock_victim(struct pagetable **pt, vaddr_t *vaddr,
+                             u_int32_t *budget) {
+    int spl, over;
+    u_int32_t index, n;
+
+    spl = splhigh();
+
+    // pages of page tables above their working set are looked at first,
+    // if there are any, for up to half the budget. the hand moves at most
+    // *budget frames in all, so a caller picking several times bounds the
+    // time spent at splhigh
+    for (over = pt_ws_over(NULL); over >= 0; over--) {
+        for (n = over ? *budget / 2 : *budget; n > 0; n--) {
+            (*budget)--;
+            index = clock_hand;
+            clock_hand = (clock_hand + 1) % cm_size;
+
+            // only user pages can be replaced, and only if one process maps
+            // them, since the reverse map only knows about one
+            if (!cm[index].use || cm[index].owner == NULL ||
+                cm[index].refcount > 1) {
+                continue;
+            }
+            if (over && !pt_ws_over(cm[index].owner)) {
+                continue;
+            }
+
+            if (cm[index].ref) {
+                // second chance. drop it from the TLB so the next access
+                // faults and sets the bit again
+                cm[index].ref = 0;
+                pt_tlb_invalidate(cm[index].owner, cm[index].vpn << 12);
+                continue;
+            }
+
+            if (over) {
+                _vmstats_inc(VMSTAT_WS_EVICT);
+            }
+            *pt = cm[index].owner;
+            *vaddr = cm[index].vpn << 12;
+            splx(spl);
+            return CM_PADDR(index);
+        }
+    }
+
+    splx(spl);
+    return 0;
+}
+
+void coremap_ws_scan(u_int32_t start, u_int32_t npages) {
+    u_int32_t i;
+
+    assert(curspl > 0);
+
+    for (i = start; i < start + npages && i < cm_size; i++) {
+        if (!cm[i].use || cm[i].owner == NULL || cm[i].refcount > 1) {
+            continue;
+        }
+        if (pt_ws_account(cm[i].owner, cm[i].ref)) {
+            cm[i].ref = 0;
+        }
+    }
+}
+
+u_int32_t coremap_nuser() {
+    u_int32_t i, n = 0;
+
+    // only a sanity check, so no need to hold off interrupts for it
+    for (i = 0; i < cm_size; i++) {
+        if (cm[i].use && cm[i].refcount > 0) {
+            n++;
+        }
+    }
+    return n;
+}
+
+u_int32_t coremap_nfree() {
+    return cm_nfree + zero_count;
+}
+
+u_int32_t coremap_npages() {
+    return cm_size;
+}
+
+void coremap_printstats() {
+    int spl, i, largest = -1;
+    u_int32_t frag;
+
+    spl = splhigh();
+
+    kprintf("COREMAP: %u of %u pages free, %u more zeroed\n", cm_nfree, cm_size,
+            zero_count);
+    for (i = 0; i < CM_NORDERS; i++) {
+        if (free_count[i] > 0) {
+            kprintf("COREMAP order %2d (%6d pages) free blocks = %u\n",
+                    i, 1 << i, free_count[i]);
+            largest = i;
+        }
+    }
+
+    // percentage of free memory that is not in the largest free block
+    frag = 0;
+    if (cm_nfree > 0 && largest >= 0) {
+        frag = 100 - (100 * (1 << largest)) / cm_nfree;
     }
+    kprintf("COREMAP fragmentation = %u%%\n", frag);
 
     splx(spl);
 }
@@ -0,0 +1,604 @@
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <vm.h>
+#include <uio.h>
+#include <vnode.h>
+#include <coremap.h>
+#include <pagecache.h>
+#include <machine/spl.h>
+#include "uw-vmstats.h"
+
+
+// every cached page is on two hash chains, one to find it by its place
+// in the file and one to find it by frame when the frame goes away.
+// idle pages are also on the LRU list, oldest first
+#define PC_NBUCKETS 128
+
+struct pc_page {
+    struct vnode *v;
+    u_int32_t offset;
+    paddr_t paddr;
+    int idle;
+    struct pc_page *next_key;
+    struct pc_page *next_frame;
+    struct pc_page *lru_prev;
+    struct pc_page *lru_next;
+};
+
+static struct pc_page *by_key[PC_NBUCKETS];
+static struct pc_page *by_frame[PC_NBUCKETS];
+static struct pc_page *lru_head;
+static struct pc_page *lru_tail;
+
+// entries are recycled rather than freed, so that giving up a frame
+// from inside the frame allocator never calls into kfree
+static struct pc_page *spare;
+
+#define KEY_HASH(v, offset) \
+    ((((u_int32_t)(v) >> 4) + ((offset) >> 12)) % PC_NBUCKETS)
+#define FRAME_HASH(paddr) (((paddr) >> 12) % PC_NBUCKETS)
+
+static struct pc_page *pc_find_key(struct vnode *v, u_int32_t offset) {
+    struct pc_page *p;
+
+    for (p = by_key[KEY_HASH(v, offset)]; p != NULL; p = p->next_key) {
+        if (p->v == v && p->offset == offset) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static struct pc_page *pc_find_frame(paddr_t paddr) {
+    struct pc_page *p;
+
+    for (p = by_frame[FRAME_HASH(paddr)]; p != NULL; p = p->next_frame) {
+        if (p->paddr == paddr) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static void lru_append(struct pc_page *p) {
+    p->idle = 1;
+    p->lru_next = NULL;
+    p->lru_prev = lru_tail;
+    if (lru_tail != NULL) {
+        lru_tail->lru_next = p;
+    }
+    else {
+        lru_head = p;
+    }
+    lru_tail = p;
+}
+
+static void lru_remove(struct pc_page *p) {
+    if (p->lru_prev != NULL) {
+        p->lru_prev->lru_next = p->lru_next;
+    }
+    else {
+        lru_head = p->lru_next;
+    }
+    if (p->lru_next != NULL) {
+        p->lru_next->lru_prev = p->lru_prev;
+    }
+    else {
+        lru_tail = p->lru_prev;
+    }
+    p->idle = 0;
+}
+
+// takes p out of the cache. its frame is left alone
+static void pc_unlink(struct pc_page *p) {
+    struct pc_page **pp;
+
+    if (p->idle) {
+        lru_remove(p);
+    }
+
+    for (pp = &by_key[KEY_HASH(p->v, p->offset)]; *pp != p;
+         pp = &(*pp)->next_key) {
+        assert(*pp != NULL);
+    }
+    *pp = p->next_key;
+
+    for (pp = &by_frame[FRAME_HASH(p->paddr)]; *pp != p;
+         pp = &(*pp)->next_frame) {
+        assert(*pp != NULL);
+    }
+    *pp = p->next_frame;
+
+    p->next_key = spare;
+    spare = p;
+}
+
+paddr_t pagecache_lookup(struct vnode *v, u_int32_t offset) {
+    int spl;
+    struct pc_page *p;
+
+    spl = splhigh();
+    p = pc_find_key(v, offset);
+    splx(spl);
+
+    return p != NULL ? p->paddr : 0;
+}
+
+paddr_t pagecache_get(struct vnode *v, u_int32_t offset, struct pagetable *pt,
+                      vaddr_t vaddr) {
+    int spl;
+    paddr_t paddr = 0;
+    struct pc_page *p;
+
+    spl = splhigh();
+    p = pc_find_key(v, offset);
+    if (p != NULL) {
+        if (p->idle) {
+            lru_remove(p);
+            coremap_set_owner(p->paddr, pt, vaddr);
+            paddr = p->paddr;
+        }
+        else if (coremap_share(p->paddr)) {
+            paddr = p->paddr;
+        }
+    }
+    splx(spl);
+
+    return paddr;
+}
+
+void pagecache_insert(struct vnode *v, u_int32_t offset, paddr_t paddr) {
+    int spl;
+    u_int32_t key = KEY_HASH(v, offset);
+    u_int32_t frame = FRAME_HASH(paddr);
+    struct pc_page *p;
+
+    spl = splhigh();
+
+    // somebody else loaded the same page while we were reading ours.
+    // theirs stays the cached one
+    if (pc_find_key(v, offset) != NULL) {
+        splx(spl);
+        return;
+    }
+
+    if (spare != NULL) {
+        p = spare;
+        spare = p->next_key;
+    }
+    else {
+        p = kmalloc(sizeof(struct pc_page));
+        if (p == NULL) {
+            // the page just stays private
+            splx(spl);
+            return;
+        }
+    }
+
+    p->v = v;
+    p->offset = offset;
+    p->paddr = paddr;
+    p->idle = 0;
+    p->next_key = by_key[key];
+    by_key[key] = p;
+    p->next_frame = by_frame[frame];
+    by_frame[frame] = p;
+
+    if (coremap_refcount(paddr) == 0) {
+        lru_append(p);
+    }
+
+    splx(spl);
+}
+
+int pagecache_unmapped(paddr_t paddr) {
+    int spl;
+    struct pc_page *p;
+
+    spl = splhigh();
+    p = pc_find_frame(paddr);
+    if (p != NULL) {
+        assert(!p->idle && coremap_refcount(paddr) == 0);
+        lru_append(p);
+    }
+    splx(spl);
+
+    return p != NULL;
+}
+
+void pagecache_remove(paddr_t paddr) {
+    int spl;
+    struct pc_page *p;
+
+    spl = splhigh();
+    p = pc_find_frame(paddr);
+    if (p != NULL) {
+        pc_unlink(p);
+    }
+    splx(spl);
+}
+
+int pagecache_cached(paddr_t paddr) {
+    int spl, cached;
+
+    spl = splhigh();
+    cached = pc_find_frame(paddr) != NULL;
+    splx(spl);
+
+    return cached;
+}
+
+int pagecache_writeback(paddr_t paddr, int *err) {
+    int spl, pinned;
+    struct pc_page *p;
+    struct vnode *v;
+    u_int32_t offset;
+    struct stat st;
+    struct uio ku;
+    size_t len;
+
+    spl = splhigh();
+    p = pc_find_frame(paddr);
+    if (p == NULL) {
+        splx(spl);
+        return 0;
+    }
+    v = p->v;
+    offset = p->offset;
+    splx(spl);
+
+    *err = VOP_STAT(v, &st);
+    if (*err) {
+        return 1;
+    }
+
+    // whatever was stored past the end of the file is dropped
+    if ((off_t)offset >= st.st_size) {
+        return 1;
+    }
+    len = PAGE_SIZE;
+    if (len > (size_t)(st.st_size - offset)) {
+        len = st.st_size - offset;
+    }
+
+    // an extra reference keeps the frame from being evicted and reused
+    // while the write sleeps
+    pinned = coremap_share(paddr);
+    mk_kuio(&ku, (void *)PADDR_TO_KVADDR(paddr), len, offset, UIO_WRITE);
+    *err = VOP_WRITE(v, &ku);
+    if (pinned) {
+        coremap_unshare(paddr, NULL);
+    }
+    vmstats_inc(VMSTAT_MMAP_WRITEBACK);
+    return 1;
+}
+
+int pagecache_reclaim(void) {
+    struct pc_page *p = lru_head;
+    paddr_t paddr;
+
+    assert(curspl == SPL_HIGH);
+    if (p == NULL) {
+        return 0;
+    }
+
+    paddr = p->paddr;
+    pc_unlink(p);
+    ungetppages(paddr);
+    return 1;
+}
+
+void pagecache_purge(struct vnode *v) {
+    int spl, i, idle;
+    paddr_t paddr;
+    struct pc_page *p, *next;
+
+    spl = splhigh();
+    for (i = 0; i < PC_NBUCKETS; i++) {
+        for (p = by_key[i]; p != NULL; p = next) {
+            next = p->next_key;
+            if (p->v != v) {
+                continue;
+            }
+            // frames still in use are freed by whoever lets go of them
+            // last, once they find them gone from the cache
+            paddr = p->paddr;
+            idle = p->idle;
+            pc_unlink(p);
+            if (idle) {
+                ungetppages(paddr);
+            }
+        }
+    }
+    splx(spl);
+}
+
+// takes a reference to the cached page of v at offset for copying,
+// reading it from the file first if it is not cached. returns 0 if there
+// is no frame for it, or if the cached frame has too many users already
+static paddr_t pc_hold(struct vnode *v, u_int32_t offset, int fill,
+                       int *err) {
+    int spl;
+    paddr_t paddr, mine;
+    struct uio ku;
+
+    spl = splhigh();
+    if (pagecache_lookup(v, offset) != 0) {
+        // 0 if it has too many users, the caller copies without a
+        // reference then
+        paddr = pagecache_get(v, offset, NULL, 0);
+        splx(spl);
+        if (paddr != 0) {
+            vmstats_inc(VMSTAT_FILE_CACHE_HIT);
+        }
+        return paddr;
+    }
+    splx(spl);
+
+    if (!fill) {
+        return 0;
+    }
+
+    // never evict process pages to cache a file
+    mine = getppages(1);
+    if (mine == 0) {
+        return 0;
+    }
+    coremap_set_owner(mine, NULL, 0);
+
+    mk_kuio(&ku, (void *)PADDR_TO_KVADDR(mine), PAGE_SIZE, offset, UIO_READ);
+    *err = VOP_READ(v, &ku);
+    if (*err) {
+        coremap_unshare(mine, NULL);
+        ungetppages(mine);
+        return 0;
+    }
+    // past the end of the file
+    bzero((void *)(PADDR_TO_KVADDR(mine) + PAGE_SIZE - ku.uio_resid),
+          ku.uio_resid);
+    vmstats_inc(VMSTAT_FILE_CACHE_MISS);
+
+    spl = splhigh();
+    if (pagecache_lookup(v, offset) != 0) {
+        // read in by somebody else meanwhile, use theirs
+        coremap_unshare(mine, NULL);
+        ungetppages(mine);
+        paddr = pagecache_get(v, offset, NULL, 0);
+    }
+    else {
+        pagecache_insert(v, offset, mine);
+        paddr = mine;
+    }
+    splx(spl);
+
+    return paddr;
+}
+
+// drops a reference taken by pc_hold
+static void pc_release(paddr_t paddr) {
+    int spl;
+
+    spl = splhigh();
+    if (coremap_unshare(paddr, NULL) == 0 && !pagecache_unmapped(paddr)) {
+        ungetppages(paddr);
+    }
+    splx(spl);
+}
+
+// reads or writes the next len bytes of u straight from the file
+static int pc_direct(struct vnode *v, struct uio *u, size_t len) {
+    size_t resid = u->uio_resid;
+    int err;
+
+    u->uio_resid = len;
+    if (u->uio_rw == UIO_READ) {
+        err = VOP_READ(v, u);
+    }
+    else {
+        err = VOP_WRITE(v, u);
+    }
+    u->uio_resid = resid - (len - u->uio_resid);
+    return err;
+}
+
+// copies len bytes between buf and the cached page of v at base, from
+// inpage on, without taking a reference to its frame. for frames that
+// already have the most references they can count. the copy is done at
+// splhigh, so the frame cannot be reused meanwhile. returns 0 if the
+// page is not cached
+static int pc_copy_saturated(struct vnode *v, u_int32_t base,
+                             u_int32_t inpage, char *buf, size_t len,
+                             int toframe) {
+    int spl;
+    paddr_t paddr;
+    char *frame;
+
+    spl = splhigh();
+    paddr = pagecache_lookup(v, base);
+    if (paddr != 0) {
+        frame = (char *)PADDR_TO_KVADDR(paddr) + inpage;
+        if (toframe) {
+            memcpy(frame, buf, len);
+        }
+        else {
+            memcpy(buf, frame, len);
+        }
+    }
+    splx(spl);
+
+    return paddr != 0;
+}
+
+static int pc_regular(struct vnode *v) {
+    u_int32_t type;
+
+    return VOP_GETTYPE(v, &type) == 0 && type == S_IFREG;
+}
+
+// reads len bytes of u from the cached page of v at base through a
+// buffer, for a frame that cannot take another reference. the buffer is
+// needed because copying to the user may sleep
+static int pc_saturated_read(struct vnode *v, struct uio *u, u_int32_t base,
+                             u_int32_t inpage, size_t len) {
+    char *buf;
+    int err;
+
+    buf = kmalloc(len);
+    if (buf == NULL) {
+        return ENOMEM;
+    }
+    if (pc_copy_saturated(v, base, inpage, buf, len, 0)) {
+        err = uiomove(buf, len, u);
+    }
+    else {
+        // given up meanwhile, so the file is up to date
+        err = pc_direct(v, u, len);
+    }
+    kfree(buf);
+    return err;
+}
+
+// writes len bytes of u to the file and to the cached page of v at base,
+// for a frame that cannot take another reference. the user's bytes are
+// copied once, into a buffer both are updated from
+static int pc_saturated_write(struct vnode *v, struct uio *u, u_int32_t base,
+                              u_int32_t inpage, size_t len) {
+    struct uio ku;
+    u_int32_t offset = u->uio_offset;
+    paddr_t paddr;
+    char *buf;
+    int err;
+
+    buf = kmalloc(len);
+    if (buf == NULL) {
+        return ENOMEM;
+    }
+    err = uiomove(buf, len, u);
+    if (!err) {
+        pc_copy_saturated(v, base, inpage, buf, len, 1);
+        mk_kuio(&ku, buf, len, offset, UIO_WRITE);
+        err = VOP_WRITE(v, &ku);
+        if (err) {
+            // the cached page may hold bytes the file does not
+            paddr = pagecache_lookup(v, base);
+            if (paddr != 0) {
+                pagecache_remove(paddr);
+            }
+        }
+    }
+    kfree(buf);
+    return err;
+}
+
+int pagecache_read(struct vnode *v, struct uio *u) {
+    struct stat st;
+    u_int32_t base, inpage;
+    size_t len;
+    paddr_t paddr;
+    int err = 0;
+
+    if (!pc_regular(v)) {
+        return VOP_READ(v, u);
+    }
+
+    err = VOP_STAT(v, &st);
+    if (err) {
+        return err;
+    }
+
+    while (u->uio_resid > 0 && u->uio_offset < st.st_size) {
+        base = u->uio_offset & PAGE_FRAME;
+        inpage = u->uio_offset - base;
+        len = PAGE_SIZE - inpage;
+        if (len > u->uio_resid) {
+            len = u->uio_resid;
+        }
+        if (len > (size_t)(st.st_size - u->uio_offset)) {
+            len = st.st_size - u->uio_offset;
+        }
+
+        paddr = pc_hold(v, base, 1, &err);
+        if (err) {
+            return err;
+        }
+        if (paddr == 0 && pagecache_lookup(v, base) != 0) {
+            // cached, but too many users to take a reference. the frame
+            // may be newer than the file, so it is still read from
+            err = pc_saturated_read(v, u, base, inpage, len);
+        }
+        else if (paddr == 0) {
+            err = pc_direct(v, u, len);
+        }
+        else {
+            err = uiomove((void *)(PADDR_TO_KVADDR(paddr) + inpage), len, u);
+            pc_release(paddr);
+        }
+        if (err) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+int pagecache_write(struct vnode *v, struct uio *u) {
+    struct uio ku;
+    u_int32_t base, inpage, offset;
+    size_t len;
+    paddr_t paddr;
+    int err = 0;
+
+    if (!pc_regular(v)) {
+        return VOP_WRITE(v, u);
+    }
+
+    while (u->uio_resid > 0) {
+        base = u->uio_offset & PAGE_FRAME;
+        inpage = u->uio_offset - base;
+        len = PAGE_SIZE - inpage;
+        if (len > u->uio_resid) {
+            len = u->uio_resid;
+        }
+
+        paddr = pc_hold(v, base, 0, &err);
+        if (paddr == 0 && pagecache_lookup(v, base) != 0) {
+            // cached, but too many users to take a reference. the page
+            // must not be left behind the file
+            err = pc_saturated_write(v, u, base, inpage, len);
+            if (err) {
+                return err;
+            }
+            continue;
+        }
+        if (paddr == 0) {
+            err = pc_direct(v, u, len);
+            if (err) {
+                return err;
+            }
+            continue;
+        }
+
+        // the user's bytes are copied once, into the cached page, and the
+        // file is written from there, so both get the same bytes even if
+        // the user buffer changes meanwhile
+        offset = u->uio_offset;
+        err = uiomove((void *)(PADDR_TO_KVADDR(paddr) + inpage), len, u);
+        if (!err) {
+            mk_kuio(&ku, (void *)(PADDR_TO_KVADDR(paddr) + inpage), len,
+                    offset, UIO_WRITE);
+            err = VOP_WRITE(v, &ku);
+        }
+        if (err) {
+            // the cached page may hold bytes the file does not
+            pagecache_remove(paddr);
+        }
+        pc_release(paddr);
+        if (err) {
+            return err;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <types.h>
+#include <lib.h>
+#include <kern/errno.h>
+#include <thread.h>
+#include <curthread.h>
+#include <coremap.h>
+#include <pt.h>
+#include <swapfile.h>
+#include <pageout.h>
+#include <machine/spl.h>
+#include "uw-vmstats.h"
+#include "opt-A2.h"
+#include "opt-clockreplace.h"
+
+
+static u_int32_t pageout_low = 0;
+static u_int32_t pageout_high = 0;
+static int pageout_running = 0;
+
+// set when the daemon found nothing it could evict. it then sleeps until
+// a frame is freed some other way instead of retrying in a busy loop
+static int pageout_stuck = 0;
+
+#if OPT_CLOCKREPLACE
+static void pageout_thread(void *unused1, unsigned long unused2) {
+    int spl;
+    u_int32_t before;
+
+    (void)unused1;
+    (void)unused2;
+
+    while (1) {
+        spl = splhigh();
+        while (pageout_stuck || coremap_nfree() >= pageout_low) {
+            thread_sleep(&pageout_low);
+        }
+        splx(spl);
+        vmstats_inc(VMSTAT_PAGEOUT_WAKEUP);
+
+        // evicting takes the locks of the page tables it takes pages
+        // from, faults elsewhere go on meanwhile
+        while (coremap_nfree() < pageout_high) {
+            before = coremap_nfree();
+            if (!pt_reclaim()) {
+                // every candidate is shared, locked or held by the
+                // kernel. wait for the next ungetppages to try again
+                spl = splhigh();
+                pageout_stuck = 1;
+                splx(spl);
+                break;
+            }
+            for (; before < coremap_nfree(); before++) {
+                vmstats_inc(VMSTAT_PAGEOUT_FREE);
+            }
+
+            // let faulting threads run between batches
+            thread_yield();
+        }
+    }
+}
+#endif // OPT_CLOCKREPLACE
+
+void pageout_bootstrap(void) {
+    // keep about 1/32 of memory free, but at least one swap batch
+    pageout_low = coremap_npages() / 32;
+    if (pageout_low < SWAP_CLUSTER) {
+        pageout_low = SWAP_CLUSTER;
+    }
+    pageout_high = 2 * pageout_low;
+
+#if OPT_CLOCKREPLACE
+    int result;
+#if OPT_A2
+    result = thread_fork("pageout", NULL, 0, pageout_thread, NULL, NULL);
+#else
+    result = thread_fork("pageout", NULL, 0, pageout_thread, NULL);
+#endif // OPT_A2
+    if (result) {
+        panic("pageout_bootstrap: thread_fork failed: %s\n",
+              strerror(result));
+    }
+    thread_count_daemon();
+    pageout_running = 1;
+#else
+    // FIFO replacement is per process, so there is no global victim for
+    // a daemon to pick. faults keep evicting synchronously
+#endif // OPT_CLOCKREPLACE
+}
+
+void pageout_check(u_int32_t nfree) {
+    if (pageout_running && nfree < pageout_low) {
+        thread_wakeup(&pageout_low);
+    }
+}
+
+void pageout_freed(void) {
+    if (pageout_stuck) {
+        pageout_stuck = 0;
+        pageout_check(coremap_nfree());
+    }
+}
+
+int pageout_set_watermarks(u_int32_t low, u_int32_t high) {
+    int spl;
+
+    if (low >= high || high > coremap_npages()) {
+        return EINVAL;
+    }
+
+    spl = splhigh();
+    pageout_low = low;
+    pageout_high = high;
+    pageout_check(coremap_nfree());
+    splx(spl);
+    return 0;
+}
+
+void pageout_get_watermarks(u_int32_t *low, u_int32_t *high) {
+    *low = pageout_low;
+    *high = pageout_high;
+}
@@ -1,6 +1,7 @@
 #include <types.h>
 #include <lib.h>
 #include <kern/errno.h>
+#include <kern/unistd.h>
 
 #include <vm.h>
 #include <elf.h>
@@ -9,65 +10,406 @@
 #include <pt.h>
 #include <coremap.h>
 #include <swapfile.h>
+#include <pagecache.h>
 #include <machine/tlb.h>
+#include <machine/spl.h>
 #include <thread.h>
 #include <curthread.h>
 #include <addrspace.h>
 #include <process.h>
 #include "uw-vmstats.h"
-#include <array.h>
 #include <linkedlist.h>
+#include <synch.h>
+#include "opt-clockreplace.h"
 
 
+// two level page table indexed by virtual page number. The top 10 bits
+// of a vaddr select a second level table in dir, which are only allocated
+// once a page in their 4MB range is touched. The next 10 bits select the
+// entry. An entry whose paddr is 0 has never been faulted in.
+#define OUT_INDEX(vaddr) ((vaddr) >> 22)
+#define IN_INDEX(vaddr)  (((vaddr) & IN_MASK) >> 12)
+
 struct pagetable {
-    struct array *entries;
+    struct pt_entry **dir;
     struct linkedlist *fifo;
+    struct lock *lock;
+
+    // TLB entries for pt's pages that were in the TLB when another
+    // address space took it over. they go back in when pt is activated
+    u_int32_t tlb_nsaved;
+    u_int32_t tlb_hi[NUM_TLB];
+    u_int32_t tlb_lo[NUM_TLB];
+
+    // working set estimate (see pt_ws_tick). ws_resident counts the
+    // frames pt owned at the last sample, less those evicted since.
+    // ws_counted and ws_referenced add up the sample being taken
+    struct pagetable *ws_prev;
+    struct pagetable *ws_next;
+    u_int32_t ws_ran;
+    u_int32_t ws_resident;
+    u_int32_t ws_counted;
+    u_int32_t ws_referenced;
+    u_int32_t ws_size;
+    u_int32_t ws_busy;
 };
 
+// working sets are sampled over PT_WS_TICKS clock ticks, each tick
+// scanning its share of memory. a page table
+// may keep PT_WS_SLACK pages and a quarter more than its working set
+// before its pages are evicted ahead of everyone else's
+#define PT_WS_TICKS 20
+#define PT_WS_SLACK 8
+#define PT_WS_TARGET(pt) ((pt)->ws_size + (pt)->ws_size / 4 + PT_WS_SLACK)
+
+// every page table, for sampling, and how many are above their target
+static struct pagetable *ws_all;
+static u_int32_t ws_nover;
+static u_int32_t ws_ticks;
+// page tables found busy while picking a victim get ws_busy set to the
+// number of the pick, and are not preferred for the rest of it
+static u_int32_t ws_pick;
+
+// the page table whose pages the TLB maps. it stays the owner while
+// kernel threads run, so going back to the same process keeps the TLB
+static struct pagetable *tlb_owner;
+
+// number of pages read per swap-in, including the faulting one. grows
+// while pages read ahead get used and halves when they are evicted unused
+static u_int32_t ra_window = SWAP_CLUSTER / 2;
+
+// number of pages read per fault on the executable, including the
+// faulting one, and the buffer a cluster is read into. a fault that
+// finds the buffer busy with another fault's read reads a single page
+static u_int32_t elf_cluster = ELF_CLUSTER;
+static char *elf_buffer;
+static int elf_buffer_busy;
+
+// a thread that finds every page it could evict in page tables busy
+// elsewhere sleeps on evict_gen. releasing a page table lock or freeing
+// a frame bumps it and wakes the sleepers
+static u_int32_t evict_gen;
+static u_int32_t evict_waiters;
+
+static void force_free_page(struct pagetable *pt);
+
 struct pagetable* pt_create() {
+    int i, spl;
     struct pagetable *pt = kmalloc(sizeof(struct pagetable));
     if (pt == NULL) {
         return NULL;
     }
 
-    pt->entries = array_create();
-    if (pt->entries == NULL) {
+    pt->dir = kmalloc(N_OUT * sizeof(struct pt_entry *));
+    if (pt->dir == NULL) {
         kfree(pt);
         return NULL;
     }
 
+    for (i=0; i<N_OUT; i++) {
+        pt->dir[i] = NULL;
+    }
+
     pt->fifo = ll_create();
     if (pt->fifo == NULL) {
-        array_destroy(pt->entries);
+        kfree(pt->dir);
         kfree(pt);
         return NULL;
     }
 
+    pt->lock = lock_create("pagetable");
+    if (pt->lock == NULL) {
+        ll_destroy(pt->fifo);
+        kfree(pt->dir);
+        kfree(pt);
+        return NULL;
+    }
+
+    pt->tlb_nsaved = 0;
+
+    pt->ws_ran = 0;
+    pt->ws_resident = 0;
+    pt->ws_counted = 0;
+    pt->ws_referenced = 0;
+    pt->ws_size = 0;
+    pt->ws_busy = 0;
+
+    spl = splhigh();
+    pt->ws_prev = NULL;
+    pt->ws_next = ws_all;
+    if (ws_all != NULL) {
+        ws_all->ws_prev = pt;
+    }
+    ws_all = pt;
+    splx(spl);
+
     return pt;
 }
 
+void pt_ws_tick(void) {
+    struct pagetable *pt;
+    u_int32_t i, ehi, elo, slice;
+
+    assert(curspl > 0);
+
+    // pages the TLB maps are being used without faulting, so their
+    // reference bits are set here. the scan can then clear the bits
+    // without throwing the TLB entries away
+    if (tlb_owner != NULL) {
+        tlb_owner->ws_ran = 1;
+        for (i=0; i<NUM_TLB; i++) {
+            TLB_Read(&ehi, &elo, i);
+            if (elo & TLBLO_VALID) {
+                coremap_set_referenced(elo & TLBLO_PPAGE);
+            }
+        }
+    }
+
+    if (ws_ticks == 0) {
+        for (pt = ws_all; pt != NULL; pt = pt->ws_next) {
+            pt->ws_counted = 0;
+            pt->ws_referenced = 0;
+        }
+    }
+
+    // a slice of memory per tick, so hardclock never walks all of it
+    slice = (coremap_npages() + PT_WS_TICKS - 1) / PT_WS_TICKS;
+    coremap_ws_scan(ws_ticks * slice, slice);
+
+    if (++ws_ticks < PT_WS_TICKS) {
+        return;
+    }
+    ws_ticks = 0;
+
+    // page tables that did not run keep their estimate, their pages
+    // not being used says nothing about what they need
+    ws_nover = 0;
+    for (pt = ws_all; pt != NULL; pt = pt->ws_next) {
+        pt->ws_resident = pt->ws_counted;
+        if (pt->ws_ran) {
+            pt->ws_size = pt->ws_referenced;
+            pt->ws_ran = 0;
+        }
+        if (pt->ws_resident > PT_WS_TARGET(pt)) {
+            ws_nover++;
+        }
+    }
+}
+
+int pt_ws_account(struct pagetable *pt, int referenced) {
+    pt->ws_counted++;
+    if (!pt->ws_ran) {
+        return 0;
+    }
+    if (referenced) {
+        pt->ws_referenced++;
+    }
+    return 1;
+}
+
+int pt_ws_over(struct pagetable *pt) {
+    if (pt == NULL) {
+        return ws_nover > 0;
+    }
+    return pt->ws_busy != ws_pick && pt->ws_resident > PT_WS_TARGET(pt);
+}
+
+void pt_activate(struct pagetable *pt) {
+    int i, spl;
+    u_int32_t ehi, elo, n;
+
+    spl = splhigh();
+
+    pt->ws_ran = 1;
+
+    if (pt == tlb_owner) {
+        _vmstats_inc(VMSTAT_TLB_FLUSH_SKIPPED);
+        splx(spl);
+        return;
+    }
+
+    // keep the outgoing owner's entries for when it comes back
+    if (tlb_owner != NULL) {
+        n = 0;
+        for (i=0; i<NUM_TLB; i++) {
+            TLB_Read(&ehi, &elo, i);
+            if (elo & TLBLO_VALID) {
+                tlb_owner->tlb_hi[n] = ehi;
+                tlb_owner->tlb_lo[n] = elo;
+                n++;
+            }
+        }
+        tlb_owner->tlb_nsaved = n;
+    }
+
+    // and load the incoming one's in the same pass that flushes the rest
+    _vmstats_inc(VMSTAT_TLB_INVALIDATE);
+    for (i=0; i<NUM_TLB; i++) {
+        if ((u_int32_t)i < pt->tlb_nsaved) {
+            TLB_Write(pt->tlb_hi[i], pt->tlb_lo[i], i);
+            _vmstats_inc(VMSTAT_TLB_RESTORE);
+        }
+        else {
+            TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+        }
+    }
+    pt->tlb_nsaved = 0;
+    tlb_owner = pt;
+
+    splx(spl);
+}
+
+void pt_evict_wakeup(void) {
+    int spl;
+
+    spl = splhigh();
+    evict_gen++;
+    if (evict_waiters > 0) {
+        thread_wakeup(&evict_gen);
+    }
+    splx(spl);
+}
+
+void pt_lock(struct pagetable *pt) {
+    lock_acquire(pt->lock);
+}
+
+void pt_unlock(struct pagetable *pt) {
+    lock_release(pt->lock);
+    pt_evict_wakeup();
+}
+
+// forgets the swap copy of the resident page at paddr, if it has one.
+// needed once the page is modified or its owner goes away
+static void pt_drop_swapcopy(paddr_t paddr) {
+    u_int32_t slot = coremap_get_swapslot(paddr);
+    if (slot != CM_NO_SWAPSLOT) {
+        coremap_set_swapslot(paddr, CM_NO_SWAPSLOT);
+        swap_free(slot);
+    }
+}
+
+// returns the frame of a user page nobody maps any more to the allocator,
+// unless it stays in the page cache
+static void pt_free_frame(paddr_t paddr) {
+    pt_drop_swapcopy(paddr);
+    if (!pagecache_unmapped(paddr)) {
+        ungetppages(paddr);
+    }
+}
+
+// writes the page at pte back to its file if it is a modified page of a
+// shared file mapping, and marks it clean
+static int pt_writeback(struct pt_entry *pte) {
+    int err = 0;
+
+    if (IS_VALID(pte->paddr) && IS_DIRTY(pte->paddr) && !IS_COW(pte->paddr) &&
+        pagecache_writeback(ALIGN(pte->paddr), &err) && !err) {
+        pte->paddr = CLEAR_DIRTY(pte->paddr);
+    }
+    return err;
+}
+
 void pt_destroy(struct pagetable *pt) {
-    int i;
+    int i, j, spl;
 
-    // free page table entries inside array
-    for (i=0; i<array_getnum(pt->entries); i++) {
-        struct pt_entry *pte = (struct pt_entry*)array_getguy(pt->entries, i);
-        if (pte != NULL) {
-            ungetppages(ALIGN(pte->paddr));
-            kfree(pte);
+    // keep evicting threads away from the pages while they go
+    lock_acquire(pt->lock);
+
+    spl = splhigh();
+    if (pt->ws_prev != NULL) {
+        pt->ws_prev->ws_next = pt->ws_next;
+    }
+    else {
+        ws_all = pt->ws_next;
+    }
+    if (pt->ws_next != NULL) {
+        pt->ws_next->ws_prev = pt->ws_prev;
+    }
+    splx(spl);
+
+    // shared file pages go back to their file first. writing can sleep,
+    // so nothing is freed until it is done
+    for (i=0; i<N_OUT; i++) {
+        if (pt->dir[i] == NULL) {
+            continue;
+        }
+        for (j=0; j<N_IN; j++) {
+            pt_writeback(&pt->dir[i][j]);
         }
     }
 
+    // free frames held by the page table and the second level tables
+    for (i=0; i<N_OUT; i++) {
+        if (pt->dir[i] == NULL) {
+            continue;
+        }
+        for (j=0; j<N_IN; j++) {
+            struct pt_entry *pte = &pt->dir[i][j];
+            if (IS_VALID(pte->paddr)) {
+                // shared pages stay until their last user is gone
+                if (coremap_unshare(ALIGN(pte->paddr), pt) == 0) {
+                    pt_free_frame(ALIGN(pte->paddr));
+                }
+            }
+            else if (IS_SWAPPED(pte->paddr)) {
+                swap_free(SWAP_SLOT(pte->paddr));
+            }
+        }
+        kfree(pt->dir[i]);
+    }
+
     // empty queue
     while (!ll_empty(pt->fifo)) {
         ll_pop_front(pt->fifo);
     }
 
-    array_destroy(pt->entries);
+    kfree(pt->dir);
     ll_destroy(pt->fifo);
+
+    // a later page table at the same address must not inherit the TLB
+    spl = splhigh();
+    if (tlb_owner == pt) {
+        for (i=0; i<NUM_TLB; i++) {
+            TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+        }
+        tlb_owner = NULL;
+    }
+    splx(spl);
+
+    // nothing maps a frame for pt any more, so no evicting thread can
+    // find it and go for the lock
+    lock_release(pt->lock);
+    lock_destroy(pt->lock);
     kfree(pt);
 }
 
+// returns the entry for vaddr. if its second level table does not exist
+// yet it is created when create is set, otherwise NULL is returned.
+// also returns NULL if the table could not be allocated
+static struct pt_entry* pt_get_entry(struct pagetable *pt, vaddr_t vaddr, int create) {
+    int j;
+    struct pt_entry *table = pt->dir[OUT_INDEX(vaddr)];
+
+    if (table == NULL) {
+        if (!create) {
+            return NULL;
+        }
+
+        table = kmalloc(N_IN * sizeof(struct pt_entry));
+        if (table == NULL) {
+            return NULL;
+        }
+
+        for (j=0; j<N_IN; j++) {
+            table[j].paddr = 0;
+        }
+        pt->dir[OUT_INDEX(vaddr)] = table;
+    }
+
+    return &table[IN_INDEX(vaddr)];
+}
+
 static int page_read(struct vnode *v, u_int32_t offset, vaddr_t vaddr,
         size_t memsize, size_t filesize) 
 {
@@ -106,64 +448,476 @@ static int page_read(struct vnode *v, u_int32_t offset, vaddr_t vaddr,
 	return result;
 }
 
-static int loadpage(struct addrspace *as, vaddr_t vaddr, paddr_t paddr) {
-    u_int32_t reg, diff, offset, filesz;
-
-    vaddr = ALIGN(vaddr);
-    paddr = ALIGN(paddr);
+// finds where the page at vaddr of the text or data segment comes from
+// in the executable. returns the segment, 0 if vaddr is in neither.
+// filesz is how much of the segment is left in the file from there, and
+// end the end of the segment
+static int pt_elf_place(struct addrspace *as, vaddr_t vaddr, u_int32_t *offset,
+                        u_int32_t *filesz, vaddr_t *end) {
+    u_int32_t reg, diff;
 
-    // get which region vaddr lies in
     reg = as_contains(as, vaddr);
 
     if (reg == SEG_TEXT) {
         diff = vaddr - as->as_vbase1;
-        filesz = as->as_filesz1 > diff ? as->as_filesz1 - diff : 0;
-        offset = as->as_offset1 + diff;
+        *filesz = as->as_filesz1 > diff ? as->as_filesz1 - diff : 0;
+        *offset = as->as_offset1 + diff;
+        *end = as->as_vbase1 + as->as_npages1 * PAGE_SIZE;
     }
     else if (reg == SEG_DATA) {
         diff = vaddr - as->as_vbase2;
-        filesz = as->as_filesz2 > diff ? as->as_filesz2 - diff : 0;
-        offset = as->as_offset2 + diff;
+        *filesz = as->as_filesz2 > diff ? as->as_filesz2 - diff : 0;
+        *offset = as->as_offset2 + diff;
+        *end = as->as_vbase2 + as->as_npages2 * PAGE_SIZE;
     }
     else {
-        // we already checked for the validity of the address before calling loadpage
+        return 0;
+    }
+    return reg;
+}
+
+// whether the page of the executable at vaddr can be shared through the
+// page cache. it must be read-only and hold a whole page of the file,
+// since file reads share the cache too
+static int pt_cacheable(struct addrspace *as, vaddr_t vaddr, u_int32_t offset,
+                        u_int32_t filesz) {
+    return !as_writeable(as, vaddr) && (offset & ~PAGE_FRAME) == 0 &&
+           filesz >= PAGE_SIZE;
+}
+
+// makes pt the owner of the frame at paddr, just read from the page of
+// the executable at vaddr, and caches it if it can be shared. the read
+// may have slept, so if another fault cached the same page meanwhile
+// that frame is mapped instead and paddr is freed. returns the frame to
+// map
+static paddr_t pt_elf_loaded(struct pagetable *pt, struct addrspace *as,
+                             vaddr_t vaddr, u_int32_t offset,
+                             u_int32_t filesz, paddr_t paddr) {
+    paddr_t cached;
+
+    coremap_set_owner(paddr, pt, vaddr);
+    if (!pt_cacheable(as, vaddr, offset, filesz)) {
+        return paddr;
+    }
+
+    cached = pagecache_get(as->as_vnode, offset, pt, vaddr);
+    if (cached != 0) {
+        coremap_unshare(paddr, pt);
+        ungetppages(paddr);
+        return cached;
+    }
+
+    // mapped before it is cached, so it is never idle
+    pagecache_insert(as->as_vnode, offset, paddr);
+    return paddr;
+}
+
+// reads the page at vaddr from the executable into the frame at *paddr,
+// which is replaced by the page cache's frame if that has the page by
+// then. the pages after it in the same segment that have not been
+// touched yet are read in the same I/O and mapped in pt too, as long as
+// there are free frames for them
+static int loadpage(struct pagetable *pt, struct addrspace *as, vaddr_t vaddr,
+                    paddr_t *paddr) {
+    u_int32_t i, n, offset, filesz;
+    vaddr_t end;
+    int err, spl, busy;
+    struct pt_entry *batch[ELF_CLUSTER];
+    paddr_t frames[ELF_CLUSTER];
+
+    vaddr = ALIGN(vaddr);
+
+    // we already checked for the validity of the address before calling loadpage
+    if (!pt_elf_place(as, vaddr, &offset, &filesz, &end)) {
         assert(0);
     }
 
 	vmstats_inc(VMSTAT_ELF_FILE_READ);
 	vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
-    return page_read(as->as_vnode, offset, PADDR_TO_KVADDR(paddr), PAGE_SIZE, filesz);
+
+    // the buffer is claimed without sleeping, so no other fault can
+    // claim it in between
+    spl = splhigh();
+    busy = elf_buffer_busy;
+    elf_buffer_busy = 1;
+    splx(spl);
+
+    if (!busy && elf_buffer == NULL && elf_cluster > 1) {
+        elf_buffer = kmalloc(ELF_CLUSTER * PAGE_SIZE);
+    }
+
+    // never evict anything to make room for fault-around
+    n = 1;
+    while (!busy && elf_buffer != NULL && n < elf_cluster &&
+           vaddr + n * PAGE_SIZE < end) {
+        batch[n] = pt_get_entry(pt, vaddr + n * PAGE_SIZE, 0);
+        if (batch[n] == NULL || batch[n]->paddr != 0) {
+            break;
+        }
+        if (pt_cacheable(as, vaddr + n * PAGE_SIZE, offset + n * PAGE_SIZE,
+                         filesz > n * PAGE_SIZE ? filesz - n * PAGE_SIZE : 0) &&
+            pagecache_lookup(as->as_vnode, offset + n * PAGE_SIZE) != 0) {
+            // mapped from the cache when it is touched
+            break;
+        }
+        frames[n] = ALIGN(getppages(1));
+        if (frames[n] == 0) {
+            break;
+        }
+        n++;
+    }
+
+    if (n == 1) {
+        if (!busy) {
+            elf_buffer_busy = 0;
+        }
+        err = page_read(as->as_vnode, offset, PADDR_TO_KVADDR(*paddr),
+                        PAGE_SIZE, filesz);
+        if (!err) {
+            *paddr = pt_elf_loaded(pt, as, vaddr, offset, filesz, *paddr);
+        }
+        return err;
+    }
+
+    err = page_read(as->as_vnode, offset, (vaddr_t)elf_buffer,
+                    n * PAGE_SIZE, filesz);
+    if (err) {
+        elf_buffer_busy = 0;
+        for (i = 1; i < n; i++) {
+            ungetppages(frames[i]);
+        }
+        return err;
+    }
+
+    memcpy((void *)PADDR_TO_KVADDR(*paddr), elf_buffer, PAGE_SIZE);
+    *paddr = pt_elf_loaded(pt, as, vaddr, offset, filesz, *paddr);
+    for (i = 1; i < n; i++) {
+        memcpy((void *)PADDR_TO_KVADDR(frames[i]), elf_buffer + i * PAGE_SIZE,
+               PAGE_SIZE);
+        frames[i] = pt_elf_loaded(pt, as, vaddr + i * PAGE_SIZE,
+                                  offset + i * PAGE_SIZE,
+                                  filesz > i * PAGE_SIZE ?
+                                  filesz - i * PAGE_SIZE : 0, frames[i]);
+        batch[i]->paddr = SET_VALID(frames[i]);
+#if OPT_CLOCKREPLACE
+#else
+        while (ll_push_back(pt->fifo, batch[i])) {
+            force_free_page(pt);
+        }
+#endif // OPT_CLOCKREPLACE
+        vmstats_inc(VMSTAT_ELF_FAULT_AROUND);
+    }
+    elf_buffer_busy = 0;
+
+    return 0;
+}
+
+void pt_set_fault_around(u_int32_t npages) {
+    if (npages < 1) {
+        npages = 1;
+    }
+    if (npages > ELF_CLUSTER) {
+        npages = ELF_CLUSTER;
+    }
+    elf_cluster = npages;
+}
+
+u_int32_t pt_get_fault_around(void) {
+    return elf_cluster;
 }
 
+#if OPT_CLOCKREPLACE
+#else
 static struct pt_entry* pt_get_fifo_victim(struct pagetable *pt) {
     return (struct pt_entry*)ll_pop_front(pt->fifo);
 }
 
-static paddr_t page_replace(struct pagetable *pt) {
+// entries do not store their address, it follows from where they sit
+static vaddr_t pt_entry_vaddr(struct pagetable *pt, struct pt_entry *pte) {
     int i;
 
-    struct pt_entry *pte = pt_get_fifo_victim(pt);
-    swapout(pte);
-    assert(ALIGN(pte->paddr) > 0);
-    assert(IS_SWAPPED(pte->paddr));
+    for (i=0; i<N_OUT; i++) {
+        if (pt->dir[i] != NULL && pte >= pt->dir[i] &&
+            pte < pt->dir[i] + N_IN) {
+            return ((vaddr_t)i << 22) | ((vaddr_t)(pte - pt->dir[i]) << 12);
+        }
+    }
+    panic("pt_entry_vaddr: entry not in its page table\n");
+    return 0;
+}
+#endif // OPT_CLOCKREPLACE
+
+// picks the next page to evict. with clock replacement the victim may
+// belong to any address space and is taken off the clock so it cannot be
+// picked twice, with FIFO it is pt's oldest. the owner's lock is held on
+// return; locked is set if it was taken here and must be released once
+// the page is gone. the victim's address is returned in vaddr. returns
+// NULL if there is nothing left to evict
+static struct pt_entry* pt_pick_victim(struct pagetable *pt,
+                                       struct pagetable **owner,
+                                       vaddr_t *vaddr, int *locked) {
+    struct pt_entry *pte;
+
+    *locked = 0;
+
+#if OPT_CLOCKREPLACE
+    int spl;
+    u_int32_t budget;
+    paddr_t paddr;
 
-    /*if (IS_DIRTY(pte->paddr)) {
-        kprintf("swapout(pte)\n");
-        swapout(pte);
+    (void)pt;
+
+    // picking the page and locking its owner happen without sleeping in
+    // between, so the page cannot change hands meanwhile. page tables
+    // another thread is faulting on or changing are passed over; that
+    // thread only ever tries for our lock, so there is no deadlock.
+    // interrupts are off throughout, so the hand goes around at most
+    // once. if that finds nothing the caller yields and tries again
+    spl = splhigh();
+    ws_pick++;
+    budget = coremap_npages();
+    while ((paddr = coremap_clock_victim(owner, vaddr, &budget)) != 0) {
+        if (!lock_do_i_hold((*owner)->lock)) {
+            if (!lock_tryacquire((*owner)->lock)) {
+                // a process above its working set is often busy
+                // faulting, do not keep coming back to it
+                (*owner)->ws_busy = ws_pick;
+                continue;
+            }
+            *locked = 1;
+        }
+
+        pte = pt_get_entry(*owner, *vaddr, 0);
+        assert(pte != NULL);
+        assert(IS_VALID(pte->paddr) && ALIGN(pte->paddr) == paddr);
+        coremap_set_owner(paddr, NULL, 0);
+        if ((*owner)->ws_resident > 0) {
+            (*owner)->ws_resident--;
+        }
+        splx(spl);
+        return pte;
+    }
+    splx(spl);
+    pte = NULL;
+#else
+    int n;
+
+    assert(lock_do_i_hold(pt->lock));
+
+    // shared pages cannot be evicted, move them to the back. entries
+    // unmapped by sbrk are just dropped
+    *owner = pt;
+    for (n = ll_size(pt->fifo); n > 0; n--) {
+        pte = pt_get_fifo_victim(pt);
+        if (!IS_VALID(pte->paddr)) {
+            continue;
+        }
+        if (coremap_refcount(ALIGN(pte->paddr)) == 1) {
+            *vaddr = pt_entry_vaddr(pt, pte);
+            return pte;
+        }
+        ll_push_back(pt->fifo, pte);
+    }
+    pte = NULL;
+#endif // OPT_CLOCKREPLACE
+
+    return pte;
+}
+
+void pt_tlb_invalidate(struct pagetable *owner, vaddr_t vaddr) {
+    int i, spl;
+    u_int32_t j;
+
+    spl = splhigh();
+    if (owner == tlb_owner) {
+        i = TLB_Probe(vaddr, 0);
+        if (i >= 0)
+            TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
     }
     else {
-        kprintf("pte->paddr = SET_INVALID(pte->paddr)\n");
-        pte->paddr = SET_INVALID(pte->paddr);
-    }*/
+        for (j = 0; j < owner->tlb_nsaved; j++) {
+            if ((owner->tlb_hi[j] & TLBHI_VPAGE) == vaddr) {
+                owner->tlb_nsaved--;
+                owner->tlb_hi[j] = owner->tlb_hi[owner->tlb_nsaved];
+                owner->tlb_lo[j] = owner->tlb_lo[owner->tlb_nsaved];
+                break;
+            }
+        }
+    }
+    splx(spl);
+}
 
-    // invalidate tlb entry
-    i = TLB_Probe(pte->vaddr, pte->paddr);
-    if (i >= 0)
-        TLB_Write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+// unmaps a page that does not need to be written out
+static void pt_evict_clean(struct pt_entry *pte) {
+    paddr_t paddr = ALIGN(pte->paddr);
 
-    return ALIGN(pte->paddr);
+    if (coremap_take_readahead(paddr)) {
+        // read ahead for nothing, be less eager
+        vmstats_inc(VMSTAT_SWAP_READAHEAD_MISS);
+        ra_window = ra_window > 2 ? ra_window / 2 : 1;
+    }
+
+    // the frame is about to hold something else
+    pagecache_remove(paddr);
+
+    if (coremap_get_swapslot(paddr) != CM_NO_SWAPSLOT) {
+        // unmodified since it was swapped in, the slot is still good
+        pte->paddr = SET_SWAPPED(coremap_get_swapslot(paddr) << 12);
+        coremap_set_swapslot(paddr, CM_NO_SWAPSLOT);
+    }
+    else {
+        // clean pages can be fetched from the ELF file again, so just
+        // forget about them. the next fault reloads them via loadpage
+        pte->paddr = 0;
+    }
+    vmstats_inc(VMSTAT_PAGE_EVICT_CLEAN);
 }
 
+// evicts a page to make room for one in pt and returns its frame, or 0
+// if there is nothing to evict. if the victim is dirty, up to
+// SWAP_CLUSTER victims are taken at once so their dirty pages can share
+// a single swapfile write. the extra frames go back to the allocator
+static paddr_t pt_evict(struct pagetable *pt) {
+    u_int32_t i, n, picked, nheld;
+    int locked;
+    paddr_t paddr;
+    struct pt_entry *pte;
+    struct pagetable *owner;
+    vaddr_t vaddr;
+    struct pt_entry *batch[SWAP_CLUSTER];
+    paddr_t frames[SWAP_CLUSTER];
+    struct pagetable *held[SWAP_CLUSTER];
+
+    pte = pt_pick_victim(pt, &owner, &vaddr, &locked);
+    if (pte == NULL) {
+        return 0;
+    }
+    nheld = 0;
+    if (locked) {
+        held[nheld++] = owner;
+    }
+    pt_tlb_invalidate(owner, vaddr);
+
+    // shared file pages are cleaned by writing them to their file
+    pt_writeback(pte);
+
+    paddr = ALIGN(pte->paddr);
+    if (!IS_DIRTY(pte->paddr)) {
+        pt_evict_clean(pte);
+        for (i = 0; i < nheld; i++) {
+            pt_unlock(held[i]);
+        }
+        return paddr;
+    }
+
+    // the only copy of the page is in memory
+    n = 0;
+    batch[n] = pte;
+    frames[n++] = paddr;
+
+    for (picked = 1; picked < SWAP_CLUSTER; picked++) {
+        pte = pt_pick_victim(pt, &owner, &vaddr, &locked);
+        if (pte == NULL) {
+            break;
+        }
+        if (locked) {
+            held[nheld++] = owner;
+        }
+        pt_tlb_invalidate(owner, vaddr);
+        pt_writeback(pte);
+
+        if (IS_DIRTY(pte->paddr)) {
+            batch[n] = pte;
+            frames[n++] = ALIGN(pte->paddr);
+        }
+        else {
+            paddr = ALIGN(pte->paddr);
+            pt_evict_clean(pte);
+            ungetppages(paddr);
+        }
+    }
+
+    swapout_cluster(batch, n);
+    for (i = 0; i < n; i++) {
+        assert(IS_SWAPPED(batch[i]->paddr));
+        // a shared file page that could not be written to its file
+        pagecache_remove(frames[i]);
+        if (i > 0) {
+            ungetppages(frames[i]);
+        }
+    }
+    for (i = 0; i < nheld; i++) {
+        pt_unlock(held[i]);
+    }
+
+    return frames[0];
+}
+
+static paddr_t page_replace(struct pagetable *pt) {
+    paddr_t paddr;
+    u_int32_t gen;
+    int spl;
+
+    // the only pages left may belong to page tables busy elsewhere, in
+    // the middle of disk I/O. wait for one of them to let go of its lock
+    // or for a frame to be freed, however long that takes
+    while (1) {
+        gen = evict_gen;
+
+        // a pass that only found referenced pages cleared their bits, so
+        // the next one usually finds a victim
+        paddr = pt_evict(pt);
+        if (paddr == 0) {
+            paddr = pt_evict(pt);
+        }
+        if (paddr == 0) {
+            paddr = ALIGN(getppages(1));
+        }
+        if (paddr != 0) {
+            return paddr;
+        }
+
+        if (coremap_nuser() == 0) {
+            panic("page_replace: no user pages left to evict\n");
+        }
+
+        spl = splhigh();
+        if (gen == evict_gen) {
+            evict_waiters++;
+            thread_sleep(&evict_gen);
+            evict_waiters--;
+        }
+        splx(spl);
+    }
+}
+
+#if OPT_CLOCKREPLACE
+int pt_reclaim(void) {
+    int spl, freed;
+    paddr_t paddr;
+
+    // idle page cache frames are the cheapest thing to give up
+    spl = splhigh();
+    freed = pagecache_reclaim();
+    splx(spl);
+    if (freed) {
+        return 1;
+    }
+
+    // a pass that only found referenced pages cleared their bits, so
+    // the next one usually finds a victim
+    paddr = pt_evict(NULL);
+    if (paddr == 0) {
+        paddr = pt_evict(NULL);
+    }
+    if (paddr == 0) {
+        return 0;
+    }
+    ungetppages(paddr);
+    return 1;
+}
+#endif // OPT_CLOCKREPLACE
+
 static void zero_out_page(paddr_t paddr) {
     struct uio ku;
     paddr = ALIGN(paddr); assert(paddr > 0);
@@ -177,91 +931,504 @@ static void zero_out_page(paddr_t paddr) {
 static void force_free_page(struct pagetable *pt) {
     paddr_t p = page_replace(pt);
     assert(ALIGN(p) > 0);
-    zero_out_page(p);
     ungetppages(p);
 }
 
-// copies vpn from elf to memory
+// copies vpn from elf to memory, or zero fills it for the stack
 paddr_t pt_pagefault_handler(struct pagetable *pt, vaddr_t vaddr, int *err) {
+    int reg, zero;
+    paddr_t paddr;
     assert(*err == 0);
 
-    paddr_t paddr = ALIGN(getppages(1));
+    // stack, heap and anonymous mapping pages start out zeroed, the rest
+    // comes from the elf, which overwrites the whole page
+    reg = as_contains(curthread->t_vmspace, vaddr);
+    zero = (reg == SEG_STCK || reg == SEG_HEAP || reg == SEG_MMAP);
+
+    paddr = ALIGN(zero ? getzeroedpage() : getppages(1));
 
     // no memory
     if (paddr == 0) {
         paddr = page_replace(pt);
-        zero_out_page(paddr);
+        if (zero) {
+            zero_out_page(paddr);
+        }
     }
-    else  {
-        // load from elf
-        *err = loadpage(curthread->t_vmspace, vaddr, paddr);
+
+    if (zero) {
+        vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+        coremap_set_owner(paddr, pt, vaddr);
+        return SET_VALID(paddr);
     }
 
+    // load from elf. the page may end up in a frame of the page cache
+    *err = loadpage(pt, curthread->t_vmspace, vaddr, &paddr);
+
     if (*err)
         return 0;
 
     return SET_VALID(paddr);
 }
 
-paddr_t pt_lookup(struct pagetable *pt, vaddr_t vaddr, int *err) {
-    assert(*err == 0);
+// gives pt its own copy of the copy-on-write page at pte, or just takes
+// the page over if nobody else maps it any more. pages of the page cache
+// are always copied, they must keep what the file holds
+static void pt_cow_break(struct pagetable *pt, vaddr_t vaddr,
+                         struct pt_entry *pte) {
+    paddr_t old = ALIGN(pte->paddr);
+    paddr_t new;
+    int pinned;
 
-    struct pt_entry *pte;
-    int i, found = 0;
+    if (coremap_refcount(old) > 1 || pagecache_cached(old)) {
+        // shared pages are never picked for eviction, so an extra
+        // reference keeps old put while a frame is found for the copy
+        pinned = coremap_share(old);
+        new = ALIGN(getppages(1));
+        if (new == 0) {
+            new = page_replace(pt);
+        }
+        memcpy((void *)PADDR_TO_KVADDR(new), (void *)PADDR_TO_KVADDR(old),
+               PAGE_SIZE);
+        if (pinned) {
+            coremap_unshare(old, NULL);
+        }
+        if (coremap_unshare(old, pt) == 0) {
+            pt_free_frame(old);
+        }
+        vmstats_inc(VMSTAT_COW_COPY);
 
-    // align the virtual address
-    vaddr = ALIGN(vaddr);
+        // the copy is not in swap, so it is dirty from the start
+        pte->paddr = SET_DIRTY(SET_VALID(new));
+    }
+
+    pte->paddr = CLEAR_COW(pte->paddr);
+    coremap_set_owner(ALIGN(pte->paddr), pt, vaddr);
+}
+
+// brings the swapped out page at vaddr back in. neighbouring pages of the
+// same address space that sit in the following swap slots are read in the
+// same I/O, as long as there are free frames for them
+static int pt_swapin(struct pagetable *pt, vaddr_t vaddr,
+                     struct pt_entry *pte) {
+    u_int32_t i, n, slot;
+    int err;
+    paddr_t paddr;
+    struct pt_entry *next;
+    struct pt_entry *batch[SWAP_CLUSTER];
+    paddr_t frames[SWAP_CLUSTER];
+
+    slot = SWAP_SLOT(pte->paddr);
+    paddr = ALIGN(getppages(1));
+    if (paddr == 0) {
+        paddr = page_replace(pt);
+    }
 
-    // look for it in the pagetable
-    for (i=0; i<array_getnum(pt->entries); i++) {
-        pte = (struct pt_entry*)array_getguy(pt->entries, i);
-        if (ALIGN(pte->vaddr) == vaddr) {
-            found = 1;
+    n = 0;
+    batch[n] = pte;
+    frames[n++] = paddr;
+
+    // never evict anything to make room for readahead
+    while (n < ra_window) {
+        next = pt_get_entry(pt, vaddr + n * PAGE_SIZE, 0);
+        if (next == NULL || IS_VALID(next->paddr) ||
+            !IS_SWAPPED(next->paddr) || SWAP_SLOT(next->paddr) != slot + n) {
+            break;
+        }
+        paddr = ALIGN(getppages(1));
+        if (paddr == 0) {
             break;
         }
+        batch[n] = next;
+        frames[n++] = paddr;
     }
 
-    if (found) {
-        if (IS_VALID(pte->paddr)) {
-            // TLB miss for a page in memory
-            vmstats_inc(VMSTAT_TLB_RELOAD);
+    err = swapin_cluster(batch, frames, n);
+    if (err) {
+        // every entry is still swapped out
+        for (i = 0; i < n; i++) {
+            ungetppages(frames[i]);
+        }
+        return err;
+    }
+
+    for (i = 0; i < n; i++) {
+#if OPT_CLOCKREPLACE
+#else
+        while (ll_push_back(pt->fifo, batch[i])) {
+            force_free_page(pt);
+        }
+#endif // OPT_CLOCKREPLACE
+        coremap_set_owner(frames[i], pt, vaddr + i * PAGE_SIZE);
+
+        // keep the slot, so the page can be dropped again for free as
+        // long as it is not written to. the coremap cannot name slots
+        // that far out on a large swap device, those are given up and
+        // the page is written out again when it is evicted
+        if (slot + i < CM_NO_SWAPSLOT) {
+            coremap_set_swapslot(frames[i], slot + i);
+        }
+        else {
+            swap_free(slot + i);
+            batch[i]->paddr = SET_DIRTY(batch[i]->paddr);
+        }
+
+        if (i > 0) {
+            vmstats_inc(VMSTAT_SWAP_READAHEAD);
+            coremap_set_readahead(frames[i]);
+        }
+    }
+
+    return 0;
+}
+
+// returns the frame holding the read-only page of the executable at
+// vaddr, mapped by pt from now on, if the page cache has it. returns 0
+// otherwise
+static paddr_t pt_cache_lookup(struct pagetable *pt, vaddr_t vaddr) {
+    u_int32_t offset, filesz;
+    vaddr_t end;
+    struct addrspace *as = curthread->t_vmspace;
+
+    if (!pt_elf_place(as, vaddr, &offset, &filesz, &end) ||
+        !pt_cacheable(as, vaddr, offset, filesz)) {
+        return 0;
+    }
+
+    return pagecache_get(as->as_vnode, offset, pt, vaddr);
+}
+
+// maps the page of the file mapping mr at vaddr, from the page cache or
+// read in from the file and cached. pages of private mappings are
+// mapped copy-on-write, so writes to them never reach the cached page
+// takes a reference to the cached page of mr at offset for pt at vaddr.
+// every mapper of a shared page must map the same frame, so while the
+// frame has the most references it can count this waits for one to go
+static paddr_t pt_mmap_get(struct pagetable *pt, struct mmap_region *mr,
+                           u_int32_t offset, vaddr_t vaddr) {
+    paddr_t paddr;
+
+    paddr = pagecache_get(mr->mr_vnode, offset, pt, vaddr);
+    while (paddr == 0 && (mr->mr_flags & MAP_SHARED) &&
+           pagecache_lookup(mr->mr_vnode, offset) != 0) {
+        thread_yield();
+        paddr = pagecache_get(mr->mr_vnode, offset, pt, vaddr);
+    }
+    return paddr;
+}
+
+static int pt_mmap_fault(struct pagetable *pt, struct mmap_region *mr,
+                         vaddr_t vaddr, struct pt_entry *pte) {
+    u_int32_t offset = mr->mr_offset + (vaddr - mr->mr_start);
+    paddr_t paddr, mine;
+    struct uio ku;
+    int err;
+
+    paddr = pt_mmap_get(pt, mr, offset, vaddr);
+    if (paddr != 0) {
+        vmstats_inc(VMSTAT_TLB_RELOAD);
+        vmstats_inc(VMSTAT_PAGE_CACHE_HIT);
+    }
+    else {
+        mine = ALIGN(getppages(1));
+        if (mine == 0) {
+            mine = page_replace(pt);
+        }
+        coremap_set_owner(mine, pt, vaddr);
+
+        mk_kuio(&ku, (void *)PADDR_TO_KVADDR(mine), PAGE_SIZE, offset,
+                UIO_READ);
+        err = VOP_READ(mr->mr_vnode, &ku);
+        if (err) {
+            coremap_unshare(mine, pt);
+            ungetppages(mine);
+            return err;
+        }
+        // past the end of the file
+        bzero((void *)(PADDR_TO_KVADDR(mine) + PAGE_SIZE - ku.uio_resid),
+              ku.uio_resid);
+        vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+        vmstats_inc(VMSTAT_MMAP_FILE_READ);
+
+        // somebody else may have read the same page while we slept,
+        // everybody must map the same frame
+        paddr = pt_mmap_get(pt, mr, offset, vaddr);
+        if (paddr != 0) {
+            coremap_unshare(mine, pt);
+            ungetppages(mine);
         }
         else {
-            assert(IS_SWAPPED(pte->paddr));
-            *err = swapin(pte); assert(*err == 0);
-			vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+            pagecache_insert(mr->mr_vnode, offset, mine);
+            paddr = mine;
+        }
+    }
+
+    pte->paddr = SET_VALID(paddr);
+    if (mr->mr_flags & MAP_PRIVATE) {
+        pte->paddr = SET_COW(pte->paddr);
+    }
+    return 0;
+}
+
+paddr_t pt_lookup(struct pagetable *pt, vaddr_t vaddr, int write, int *err) {
+    assert(*err == 0);
+    assert(lock_do_i_hold(pt->lock));
 
-            while (ll_push_back(pt->fifo, pte)) {
-                force_free_page(pt);
+    struct pt_entry *pte;
+    paddr_t paddr;
+    struct mmap_region *mr;
+
+    // align the virtual address
+    vaddr = ALIGN(vaddr);
+
+    // find its entry, making room for a new second level table if needed.
+    // a table is a single page, so each eviction frees enough for it
+    pte = pt_get_entry(pt, vaddr, 1);
+    while (pte == NULL) {
+        force_free_page(pt);
+        pte = pt_get_entry(pt, vaddr, 1);
+    }
+
+    if (IS_VALID(pte->paddr)) {
+        // TLB miss for a page in memory
+        vmstats_inc(VMSTAT_TLB_RELOAD);
+
+        // the last user of a formerly shared page makes it evictable again
+        coremap_claim(ALIGN(pte->paddr), pt, vaddr);
+
+        if (coremap_take_readahead(ALIGN(pte->paddr))) {
+            // first use of a page read ahead, look further next time
+            vmstats_inc(VMSTAT_SWAP_READAHEAD_HIT);
+            if (ra_window < SWAP_CLUSTER) {
+                ra_window++;
             }
         }
+    }
+    else if (IS_SWAPPED(pte->paddr)) {
+        *err = pt_swapin(pt, vaddr, pte);
+        if (*err) {
+            return 0;
+        }
+        vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+    }
+    else if ((mr = as_find_mmap(curthread->t_vmspace, vaddr)) != NULL &&
+             mr->mr_vnode != NULL) {
+        // first touch of a page of a mapped file
+        *err = pt_mmap_fault(pt, mr, vaddr, pte);
+        if (*err) {
+            return 0;
+        }
 
-    } else {
-        pte = kmalloc(sizeof(struct pt_entry));
-        while (pte == NULL) {
+#if OPT_CLOCKREPLACE
+#else
+        while (ll_push_back(pt->fifo, pte)) {
             force_free_page(pt);
-            pte = kmalloc(sizeof(struct pt_entry));
         }
+#endif // OPT_CLOCKREPLACE
+    }
+    else if ((paddr = pt_cache_lookup(pt, vaddr)) != 0) {
+        // first touch, but the page is already in memory, from another
+        // process running the same program or from a read of the file
+        vmstats_inc(VMSTAT_TLB_RELOAD);
+        vmstats_inc(VMSTAT_PAGE_CACHE_HIT);
+        pte->paddr = SET_VALID(paddr);
 
-        pte->vaddr = vaddr;
+#if OPT_CLOCKREPLACE
+#else
+        while (ll_push_back(pt->fifo, pte)) {
+            force_free_page(pt);
+        }
+#endif // OPT_CLOCKREPLACE
+    }
+    else {
+        // first touch of this page
         pte->paddr = pt_pagefault_handler(pt, vaddr, err);
 
         if (*err) {
             assert(0);
-            kfree(pte);
+            pte->paddr = 0;
             return 0;
         }
 
-        while (array_add(pt->entries, pte)) {
-            force_free_page(pt);
-        }
-
+#if OPT_CLOCKREPLACE
+#else
         while (ll_push_back(pt->fifo, pte)) {
             force_free_page(pt);
         }
+#endif // OPT_CLOCKREPLACE
     }
 
-    pte->paddr = ALIGN(pte->paddr);
+    if (write) {
+        if (IS_COW(pte->paddr)) {
+            pt_cow_break(pt, vaddr, pte);
+        }
+        pt_drop_swapcopy(ALIGN(pte->paddr));
+        pte->paddr = SET_DIRTY(pte->paddr);
+    }
     pte->paddr = SET_VALID(pte->paddr);
+
+    // copy-on-write pages must stay read-only in the TLB
+    if (IS_COW(pte->paddr)) {
+        return ALIGN(pte->paddr);
+    }
+    return ALIGN(pte->paddr) | IS_DIRTY(pte->paddr);
+}
+
+paddr_t pt_set_dirty(struct pagetable *pt, vaddr_t vaddr) {
+    struct pt_entry *pte = pt_get_entry(pt, ALIGN(vaddr), 0);
+
+    assert(lock_do_i_hold(pt->lock));
+    assert(pte != NULL && IS_VALID(pte->paddr));
+    if (IS_COW(pte->paddr)) {
+        pt_cow_break(pt, ALIGN(vaddr), pte);
+    }
+    pt_drop_swapcopy(ALIGN(pte->paddr));
+    pte->paddr = SET_DIRTY(pte->paddr);
     return ALIGN(pte->paddr);
 }
+
+int pt_msync(struct pagetable *pt, vaddr_t start, vaddr_t end) {
+    int err = 0;
+    vaddr_t vaddr;
+    struct pt_entry *pte;
+
+    lock_acquire(pt->lock);
+
+    for (vaddr = ALIGN(start); vaddr < end && !err; vaddr += PAGE_SIZE) {
+        pte = pt_get_entry(pt, vaddr, 0);
+        if (pte == NULL || !IS_VALID(pte->paddr) || !IS_DIRTY(pte->paddr)) {
+            continue;
+        }
+        // the next write has to fault to mark the page dirty again
+        pt_tlb_invalidate(pt, vaddr);
+        err = pt_writeback(pte);
+    }
+
+    pt_unlock(pt);
+    return err;
+}
+
+void pt_unmap(struct pagetable *pt, vaddr_t start, vaddr_t end) {
+    vaddr_t vaddr;
+    struct pt_entry *pte;
+
+    lock_acquire(pt->lock);
+
+    for (vaddr = ALIGN(start); vaddr < end; vaddr += PAGE_SIZE) {
+        pte = pt_get_entry(pt, vaddr, 0);
+        if (pte == NULL) {
+            continue;
+        }
+
+        if (IS_VALID(pte->paddr)) {
+            pt_tlb_invalidate(pt, vaddr);
+            if (coremap_unshare(ALIGN(pte->paddr), pt) == 0) {
+                pt_free_frame(ALIGN(pte->paddr));
+            }
+        }
+        else if (IS_SWAPPED(pte->paddr)) {
+            swap_free(SWAP_SLOT(pte->paddr));
+        }
+        pte->paddr = 0;
+    }
+
+    pt_unlock(pt);
+}
+
+int pt_copy(struct pagetable *old, struct pagetable *new) {
+    int i, j, err = 0;
+    paddr_t paddr;
+    vaddr_t vaddr;
+    struct pt_entry *src, *dst;
+
+    // nobody else can know about new yet, so this never waits for it
+    lock_acquire(old->lock);
+    lock_acquire(new->lock);
+
+    for (i=0; i<N_OUT; i++) {
+        if (old->dir[i] == NULL) {
+            continue;
+        }
+        for (j=0; j<N_IN; j++) {
+            src = &old->dir[i][j];
+            if (!IS_VALID(src->paddr) && !IS_SWAPPED(src->paddr)) {
+                continue;
+            }
+
+            vaddr = ((vaddr_t)i << 22) | ((vaddr_t)j << 12);
+            dst = pt_get_entry(new, vaddr, 1);
+            if (dst == NULL) {
+                err = ENOMEM;
+                goto done;
+            }
+
+            if (IS_SWAPPED(src->paddr) && swap_dup(SWAP_SLOT(src->paddr))) {
+                dst->paddr = src->paddr;
+                continue;
+            }
+
+            paddr = ALIGN(src->paddr);
+            if (IS_SWAPPED(src->paddr)) {
+                // too many sharers of the slot already, read in a copy
+                paddr = ALIGN(getppages(1));
+                if (paddr == 0) {
+                    paddr = page_replace(old);
+                }
+                dst->paddr = src->paddr;
+                err = swapin(dst, paddr);
+                if (err) {
+                    dst->paddr = 0;
+                    ungetppages(paddr);
+                    goto done;
+                }
+                dst->paddr = SET_DIRTY(dst->paddr);
+                coremap_set_owner(paddr, new, vaddr);
+                // counted like the fault that would have read it later
+                vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+                vmstats_inc(VMSTAT_COW_COPY);
+            }
+            else if (coremap_share(paddr)) {
+                // both sides fault on their next write and copy then.
+                // pages of shared file mappings belong to the file, both
+                // sides keep writing to the same frame
+                if (IS_COW(src->paddr) || !pagecache_cached(paddr)) {
+                    src->paddr = SET_COW(src->paddr);
+                    // old may still have it writable in the TLB
+                    pt_tlb_invalidate(old, vaddr);
+                }
+                dst->paddr = src->paddr;
+            }
+            else if (!IS_COW(src->paddr) && pagecache_cached(paddr)) {
+                // too many sharers of a page of a shared file mapping. a
+                // copy would stop seeing writes to the file, so the child
+                // maps it on its first touch, through the page cache
+                dst->paddr = 0;
+                continue;
+            }
+            else {
+                // too many sharers already, copy it now
+                paddr = ALIGN(getppages(1));
+                if (paddr == 0) {
+                    paddr = page_replace(old);
+                }
+                memcpy((void *)PADDR_TO_KVADDR(paddr),
+                       (void *)PADDR_TO_KVADDR(ALIGN(src->paddr)), PAGE_SIZE);
+                dst->paddr = SET_DIRTY(SET_VALID(paddr));
+                coremap_set_owner(paddr, new, vaddr);
+                vmstats_inc(VMSTAT_COW_COPY);
+            }
+
+#if OPT_CLOCKREPLACE
+#else
+            if (ll_push_back(new->fifo, dst)) {
+                err = ENOMEM;
+                goto done;
+            }
+#endif // OPT_CLOCKREPLACE
+        }
+    }
+
+done:
+    pt_unlock(new);
+    pt_unlock(old);
+    return err;
+}
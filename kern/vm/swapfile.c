@@ -9,13 +9,37 @@
 #include <array.h>
 #include <machine/spl.h>
 #include <kern/unistd.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
 #include <thread.h>
 #include <curthread.h>
 #include <pt.h>
+#include <bitmap.h>
+#include <coremap.h>
+#include <synch.h>
+#include <zswap.h>
 
 
-static paddr_t *swappedpages_map;
-static u_int32_t count;
+// one bit per page sized slot of the swapfile. a swapped out page table
+// entry holds the number of its slot in place of the frame number
+static struct bitmap *swap_slots;
+// number of page table entries (or clean resident copies) using a slot.
+// more than one after a fork
+static u_int8_t *swap_refs;
+
+// batches of dirty pages are copied here so they can go out in one write
+static char *swap_buffer;
+// where the search for a run of free slots starts
+static u_int32_t swap_hint;
+
+// number of slots, and the raw device they are on. NULL for the swapfile
+static u_int32_t swap_npages;
+static char *swap_devname;
+
+// held across swapfile I/O, which sleeps, and while swap_buffer is in
+// use. the slot bitmap and reference counts are only changed at
+// splhigh, so slots can be shared and freed without it
+static struct lock *swap_lock;
 
 void swapfile_bootstrap() {
     int err = 0;
@@ -25,111 +49,386 @@ void swapfile_bootstrap() {
 	err = vfs_open(sf, O_RDWR | O_CREAT | O_TRUNC, &swapfile);
     assert(!err);
 	
-	swappedpages_map = kmalloc(MAX_SWAPPED_PAGES * sizeof(paddr_t));
-    assert(swappedpages_map);
+	swap_npages = MAX_SWAPFILE_SIZE / PAGE_SIZE;
+	swap_devname = NULL;
+	swap_slots = bitmap_create(swap_npages);
+    assert(swap_slots);
+    swap_refs = kmalloc(swap_npages * sizeof(u_int8_t));
+    assert(swap_refs);
+
+    swap_buffer = kmalloc(SWAP_CLUSTER * PAGE_SIZE);
+    assert(swap_buffer);
+    swap_hint = 0;
+
+    swap_lock = lock_create("swap");
+    assert(swap_lock);
 
-    count = 0;
+    zswap_bootstrap();
 }
 
-int swapout(struct pt_entry *pte) {
-    //assert(IS_DIRTY(pte->paddr));
+static int swapfile_io(vaddr_t vaddr, u_int32_t offset, u_int32_t len,
+                       enum uio_rw rw) {
+    struct uio u;
+    u.uio_iovec.iov_ubase = (void *)vaddr;
+    u.uio_iovec.iov_len = len;
+    u.uio_resid = len;
+    u.uio_offset = offset;
+    u.uio_segflg = UIO_SYSSPACE;
+    u.uio_rw = rw;
+    u.uio_space = NULL;
+    if (rw == UIO_READ) {
+        return VOP_READ(swapfile, &u);
+    }
+    return VOP_WRITE(swapfile, &u);
+}
 
-    u_int32_t i, spl, offset, err = 0, found = 0;
-	spl = splhigh();
-	
+int read_from_swapfile(vaddr_t vaddr, u_int32_t offset) {
+    return swapfile_io(vaddr, offset, PAGE_SIZE, UIO_READ);
+}
+
+int write_to_swapfile(vaddr_t vaddr, u_int32_t offset) {
+    return swapfile_io(vaddr, offset, PAGE_SIZE, UIO_WRITE);
+}
+
+// finds and allocates npages consecutive free slots, searching from the
+// hint onwards so consecutive batches land next to each other. returns
+// 0 if there is no such run
+static int swap_alloc_run(u_int32_t npages, u_int32_t *first) {
+    u_int32_t i, start, run = 0;
+
+    for (i = 0; i < swap_npages + npages; i++) {
+        start = (swap_hint + i) % swap_npages;
+        if (start == 0) {
+            // runs do not wrap around the end of the swapfile
+            run = 0;
+        }
+        if (bitmap_isset(swap_slots, start)) {
+            run = 0;
+            continue;
+        }
+        if (++run == npages) {
+            *first = start + 1 - npages;
+            for (i = *first; i <= start; i++) {
+                bitmap_mark(swap_slots, i);
+                swap_refs[i] = 1;
+            }
+            swap_hint = (start + 1) % swap_npages;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// writes one page out to a slot of its own. swap_lock must be held
+static int swapout_one(struct pt_entry *pte) {
+    u_int32_t spl, slot, err = 0;
     paddr_t pfn = ALIGN(pte->paddr);
 
-	/* get offset of the page in the swapfile (if its been swapped before) */
-	for (i=0; i<count; i++) {
-		if (pfn == swappedpages_map[i]) {
-			found = 1;
-			break;
-		}
-	}	
-	
-	/* check if we are trying to swap to a full swapfile */
-	if (count == MAX_SWAPPED_PAGES && !found) {
+    spl = splhigh();
+	if (bitmap_alloc(swap_slots, &slot)) {
 		panic("Out of swap space");
 	}
-	
-    if (found) {
-        offset = i * PAGE_SIZE;
-    }
-    else {
-        swappedpages_map[count] = pfn;
-        offset = count * PAGE_SIZE;
-        count++;
+	swap_refs[slot] = 1;
+    splx(spl);
+
+    // pages that compress well stay in memory
+    if (!zswap_store(slot, (void *)PADDR_TO_KVADDR(pfn))) {
+        err = write_to_swapfile(PADDR_TO_KVADDR(pfn), slot * PAGE_SIZE);
+        assert(!err);
+        vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+        vmstats_inc(VMSTAT_SWAP_FILE_WRITE_OPS);
     }
 
-	err = write_to_swapfile(PADDR_TO_KVADDR(pfn), offset);
-    assert(!err);
-	vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
 	// update page table entry
     // turn off all other bits and set it as swapped
-    pte->paddr = SET_SWAPPED(ALIGN(pte->paddr));
-	
-	//TODO: increment swapped out stats count
-	
-	splx(spl);
+    pte->paddr = SET_SWAPPED(slot << 12);
+
 	return err;
 }
 
+int swapout(struct pt_entry *pte) {
+    int err;
 
-int swapin(struct pt_entry *pte) {
-    assert(IS_SWAPPED(pte->paddr));
+    lock_acquire(swap_lock);
+    err = swapout_one(pte);
+    lock_release(swap_lock);
+	return err;
+}
 
-    u_int32_t i, spl, offset, err = 0, found = 0;
-    spl = splhigh();
-	
-    paddr_t pfn = ALIGN(pte->paddr);
+int swapout_cluster(struct pt_entry **ptes, u_int32_t npages) {
+    u_int32_t i, spl, first, found, lo, hi, err = 0;
+
+    assert(npages <= SWAP_CLUSTER);
+    lock_acquire(swap_lock);
+
+	spl = splhigh();
+    found = npages > 1 && swap_alloc_run(npages, &first);
+    splx(spl);
 
-    // find offset of page in swapfile
-    for (i=0; i<count; i++) {
-        if (pfn == swappedpages_map[i]) {
-            found = 1;
-            break;
+    if (!found) {
+        // a single page, or swap is too fragmented. write them one at a
+        // time
+        for (i = 0; i < npages && !err; i++) {
+            err = swapout_one(ptes[i]);
         }
+        lock_release(swap_lock);
+        return err;
     }
 
-    assert(found);
+    // pages that compress well stay in memory. the rest are written
+    // out in one go, from the first of them to the last
+    lo = npages;
+    hi = 0;
+    for (i = 0; i < npages; i++) {
+        if (zswap_store(first + i,
+                        (void *)PADDR_TO_KVADDR(ALIGN(ptes[i]->paddr)))) {
+            continue;
+        }
+        memcpy(swap_buffer + i * PAGE_SIZE,
+               (void *)PADDR_TO_KVADDR(ALIGN(ptes[i]->paddr)), PAGE_SIZE);
+        vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+        if (i < lo) {
+            lo = i;
+        }
+        hi = i + 1;
+    }
 
-	/* read page from swapfie */
-    offset = i * PAGE_SIZE;
-    err = read_from_swapfile(PADDR_TO_KVADDR(pfn), offset);
-    assert(!err);
-	vmstats_inc(VMSTAT_SWAP_FILE_READ);
+    if (lo < hi) {
+        err = swapfile_io((vaddr_t)(swap_buffer + lo * PAGE_SIZE),
+                          (first + lo) * PAGE_SIZE, (hi - lo) * PAGE_SIZE,
+                          UIO_WRITE);
+        assert(!err);
+        vmstats_inc(VMSTAT_SWAP_FILE_WRITE_OPS);
+    }
+
+    for (i = 0; i < npages; i++) {
+        ptes[i]->paddr = SET_SWAPPED((first + i) << 12);
+    }
+
+    lock_release(swap_lock);
+	return err;
+}
+
+int swapin(struct pt_entry *pte, paddr_t paddr) {
+    assert(IS_SWAPPED(pte->paddr));
+
+    u_int32_t slot, err = 0;
+
+    slot = SWAP_SLOT(pte->paddr);
+    assert(bitmap_isset(swap_slots, slot));
+
+	/* read page from memory if it was compressed, from swapfile if not */
+    lock_acquire(swap_lock);
+    if (zswap_load(slot, (void *)PADDR_TO_KVADDR(paddr))) {
+        vmstats_inc(VMSTAT_ZSWAP_HIT);
+    }
+    else {
+        err = read_from_swapfile(PADDR_TO_KVADDR(paddr), slot * PAGE_SIZE);
+        if (err) {
+            // the entry stays swapped out
+            lock_release(swap_lock);
+            return err;
+        }
+        vmstats_inc(VMSTAT_SWAP_FILE_READ);
+    }
+    lock_release(swap_lock);
 
 	// update page table entry
     // turn off all other bits and set it as valid
-    pte->paddr = ALIGN(pte->paddr);
+    pte->paddr = ALIGN(paddr);
     pte->paddr = SET_VALID(pte->paddr);
 
-    splx(spl);
     return err;
 }
 
-int read_from_swapfile(vaddr_t vaddr, u_int32_t offset) {
-    struct uio u;
-    u.uio_iovec.iov_ubase = (void *)vaddr;
-    u.uio_iovec.iov_len = PAGE_SIZE;
-    u.uio_resid = PAGE_SIZE;
-    u.uio_offset = offset;
-    u.uio_segflg = UIO_SYSSPACE;
-    u.uio_rw = UIO_READ;
-    u.uio_space = NULL;
-    return VOP_READ(swapfile, &u);
+int swapin_cluster(struct pt_entry **ptes, paddr_t *frames,
+                   u_int32_t npages) {
+    u_int32_t i, first, lo, hi, err = 0;
+
+    assert(npages <= SWAP_CLUSTER);
+    if (npages == 1) {
+        return swapin(ptes[0], frames[0]);
+    }
+
+    first = SWAP_SLOT(ptes[0]->paddr);
+    for (i = 0; i < npages; i++) {
+        assert(IS_SWAPPED(ptes[i]->paddr));
+        assert(SWAP_SLOT(ptes[i]->paddr) == first + i);
+    }
+
+    lock_acquire(swap_lock);
+
+    // only slots that are not kept compressed are read, from the first
+    // of them to the last
+    lo = npages;
+    hi = 0;
+    for (i = 0; i < npages; i++) {
+        if (!zswap_contains(first + i)) {
+            if (i < lo) {
+                lo = i;
+            }
+            hi = i + 1;
+        }
+    }
+    if (lo < hi) {
+        err = swapfile_io((vaddr_t)(swap_buffer + lo * PAGE_SIZE),
+                          (first + lo) * PAGE_SIZE, (hi - lo) * PAGE_SIZE,
+                          UIO_READ);
+        if (err) {
+            // the entries stay swapped out
+            lock_release(swap_lock);
+            return err;
+        }
+    }
+
+	// only the faulting page counts as a page fault
+	vmstats_inc(zswap_contains(first) ? VMSTAT_ZSWAP_HIT :
+	            VMSTAT_SWAP_FILE_READ);
+
+    for (i = 0; i < npages; i++) {
+        if (!zswap_load(first + i, (void *)PADDR_TO_KVADDR(frames[i]))) {
+            memcpy((void *)PADDR_TO_KVADDR(frames[i]),
+                   swap_buffer + i * PAGE_SIZE, PAGE_SIZE);
+        }
+        ptes[i]->paddr = SET_VALID(ALIGN(frames[i]));
+    }
+    lock_release(swap_lock);
+
+    return err;
 }
 
-int write_to_swapfile(vaddr_t vaddr, u_int32_t offset) {
-    struct uio u;
-    u.uio_iovec.iov_ubase = (void *)vaddr;
-    u.uio_iovec.iov_len = PAGE_SIZE;
-    u.uio_resid = PAGE_SIZE;
-    u.uio_offset = offset;
-    u.uio_segflg = UIO_SYSSPACE;
-    u.uio_rw = UIO_WRITE;
-    u.uio_space = NULL;
-    return VOP_WRITE(swapfile, &u);
+int swap_set_device(char *devname) {
+    struct vnode *v, *old;
+    struct bitmap *slots, *oldslots;
+    u_int8_t *refs, *oldrefs;
+    struct stat st;
+    char *path, *name, *oldname;
+    u_int32_t i, npages;
+    int err, spl;
+
+    // vfs_open scribbles on the path
+    path = kstrdup(devname);
+    if (path == NULL) {
+        return ENOMEM;
+    }
+    err = vfs_open(path, O_RDWR, &v);
+    kfree(path);
+    if (err) {
+        return err;
+    }
+
+    // only block devices have a size to swap to
+    npages = 0;
+    err = VOP_STAT(v, &st);
+    if (!err && (st.st_mode & S_IFMT) != S_IFBLK) {
+        err = ENODEV;
+    }
+    if (!err) {
+        npages = st.st_size / PAGE_SIZE;
+        if (npages > SWAP_MAX_SLOTS) {
+            kprintf("swap: %s has %u pages, using the first %u\n", devname,
+                    npages, SWAP_MAX_SLOTS);
+            npages = SWAP_MAX_SLOTS;
+        }
+        if (npages == 0) {
+            err = EINVAL;
+        }
+    }
+
+    slots = NULL;
+    refs = NULL;
+    name = NULL;
+    if (!err) {
+        slots = bitmap_create(npages);
+        refs = kmalloc(npages * sizeof(u_int8_t));
+        name = kstrdup(devname);
+        if (slots == NULL || refs == NULL || name == NULL) {
+            err = ENOMEM;
+        }
+    }
+
+    lock_acquire(swap_lock);
+
+    // the device must take page sized I/O at page aligned offsets
+    if (!err) {
+        old = swapfile;
+        swapfile = v;
+        err = swapfile_io((vaddr_t)swap_buffer, 0, PAGE_SIZE, UIO_READ);
+        swapfile = old;
+    }
+
+    // slots of the old swap space cannot be moved over
+    spl = splhigh();
+    for (i = 0; !err && i < swap_npages; i++) {
+        if (bitmap_isset(swap_slots, i)) {
+            err = EBUSY;
+        }
+    }
+    if (err) {
+        splx(spl);
+        lock_release(swap_lock);
+        if (slots != NULL) {
+            bitmap_destroy(slots);
+        }
+        if (refs != NULL) {
+            kfree(refs);
+        }
+        if (name != NULL) {
+            kfree(name);
+        }
+        vfs_close(v);
+        return err;
+    }
+
+    old = swapfile;
+    oldslots = swap_slots;
+    oldrefs = swap_refs;
+    oldname = swap_devname;
+    swapfile = v;
+    swap_slots = slots;
+    swap_refs = refs;
+    swap_npages = npages;
+    swap_devname = name;
+    swap_hint = 0;
+    splx(spl);
+
+    lock_release(swap_lock);
+
+    vfs_close(old);
+    bitmap_destroy(oldslots);
+    kfree(oldrefs);
+    if (oldname != NULL) {
+        kfree(oldname);
+    }
+    return 0;
+}
+
+const char *swap_get_device(u_int32_t *npages) {
+    *npages = swap_npages;
+    return swap_devname;
+}
+
+int swap_dup(u_int32_t slot) {
+    int spl = splhigh();
+    assert(bitmap_isset(swap_slots, slot));
+    if (swap_refs[slot] == 0xff) {
+        splx(spl);
+        return 0;
+    }
+    swap_refs[slot]++;
+    splx(spl);
+    return 1;
+}
+
+void swap_free(u_int32_t slot) {
+    int spl = splhigh();
+    assert(bitmap_isset(swap_slots, slot) && swap_refs[slot] > 0);
+    if (--swap_refs[slot] == 0) {
+        bitmap_unmark(swap_slots, slot);
+        zswap_drop(slot);
+    }
+    splx(spl);
 }
 
 int evict() {
@@ -18,11 +18,16 @@
 #include <types.h>
 #include <lib.h>
 #include <synch.h>
+#include <vm.h>
+#include <thread.h>
+#include <curthread.h>
+#include <kern/vmstat.h>
 #include <machine/spl.h>
 #include "uw-vmstats.h"
 
 /* Counters for tracking statistics */
 static unsigned int stats_counts[VMSTAT_COUNT];
+static unsigned int stats_hist[VMSTAT_NBUCKETS];
 
 static struct lock *stats_lock = 0;
 
@@ -38,6 +43,33 @@ static const char *stats_names[] = {
  /*  7 */ "Page Faults from ELF",
  /*  8 */ "Page Faults from Swapfile",
  /*  9 */ "Swapfile Writes",
+ /* 10 */ "Coremap Allocations",
+ /* 11 */ "Coremap Alloc Steps",
+ /* 12 */ "Coremap Fragmented Fails",
+ /* 13 */ "Clean Page Evictions",
+ /* 14 */ "TLB Faults on First Write",
+ /* 15 */ "Swapfile Write Requests",
+ /* 16 */ "Swap Readahead Pages",
+ /* 17 */ "Swap Readahead Hits",
+ /* 18 */ "Swap Readahead Misses",
+ /* 19 */ "Pageout Daemon Wakeups",
+ /* 20 */ "Pageout Daemon Frees",
+ /* 21 */ "Copy-on-write Copies",
+ /* 22 */ "ELF Fault-around Pages",
+ /* 23 */ "Page Cache Hits",
+ /* 24 */ "File Cache Hits",
+ /* 25 */ "File Cache Misses",
+ /* 26 */ "Mapped File Page Faults",
+ /* 27 */ "Mapped Pages Written Back",
+ /* 28 */ "TLB Flushes Skipped",
+ /* 29 */ "TLB Entries Restored",
+ /* 30 */ "Pre-Zeroed Pages Used",
+ /* 31 */ "Pages Zeroed While Idle",
+ /* 32 */ "Compressed Swap Stores",
+ /* 33 */ "Compressed Swap Hits",
+ /* 34 */ "Compressed Swap Bytes",
+ /* 35 */ "Compressed Swap Full",
+ /* 36 */ "Evictions Above Working Set",
 };
 
 
@@ -86,12 +118,101 @@ vmstats_print()
   lock_release(stats_lock);
 }
 
+/* ---------------------------------------------------------------------- */
+/* Charge the stats that are also kept per process to the process of the
+ * current thread. Interrupt handlers are not working for it.
+ */
+static void
+vmstats_charge(unsigned int index)
+{
+  struct vmcounts *vc;
+
+  if (in_interrupt || curthread == NULL || curthread->t_vmcounts == NULL) {
+    return;
+  }
+  vc = curthread->t_vmcounts;
+
+  switch (index) {
+    case VMSTAT_TLB_FAULT:
+      vc->vc_tlbfaults++;
+      break;
+    case VMSTAT_PAGE_FAULT_ZERO:
+      vc->vc_zerofills++;
+      break;
+    case VMSTAT_ELF_FILE_READ:
+      vc->vc_elfreads++;
+      break;
+    case VMSTAT_SWAP_FILE_READ:
+    case VMSTAT_ZSWAP_HIT:
+      vc->vc_swapreads++;
+      break;
+    case VMSTAT_SWAP_FILE_WRITE:
+      vc->vc_swapwrites++;
+      break;
+  }
+}
+
 /* ---------------------------------------------------------------------- */
 void
 _vmstats_inc(unsigned int index)
 {
   assert(index < VMSTAT_COUNT);
   stats_counts[index]++;
+  vmstats_charge(index);
+}
+
+/* ---------------------------------------------------------------------- */
+void
+vmstats_fault_time(unsigned int usecs)
+{
+  int spl;
+  unsigned int bucket = 0;
+
+  /* number of bits in usecs */
+  while (usecs > 0 && bucket < VMSTAT_NBUCKETS - 1) {
+    usecs >>= 1;
+    bucket++;
+  }
+
+  spl = splhigh();
+  stats_hist[bucket]++;
+  splx(spl);
+}
+
+/* ---------------------------------------------------------------------- */
+void
+vmstats_get_hist(unsigned int *hist)
+{
+  int spl, i;
+
+  spl = splhigh();
+  for (i=0; i<VMSTAT_NBUCKETS; i++) {
+    hist[i] = stats_hist[i];
+  }
+  splx(spl);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Assumes vmstat_init has already been called */
+void
+vmstats_add(unsigned int index, unsigned int n)
+{
+  if (curspl == SPL_HIGH) {
+    _vmstats_add(index, n);
+  } else {
+    assert(stats_lock);
+    lock_acquire(stats_lock);
+      _vmstats_add(index, n);
+    lock_release(stats_lock);
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+void
+_vmstats_add(unsigned int index, unsigned int n)
+{
+  assert(index < VMSTAT_COUNT);
+  stats_counts[index] += n;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -110,6 +231,10 @@ _vmstats_init()
     stats_counts[i] = 0;
   }
 
+  for (i=0; i<VMSTAT_NBUCKETS; i++) {
+    stats_hist[i] = 0;
+  }
+
 }
 
 /* ---------------------------------------------------------------------- */
@@ -122,6 +247,11 @@ _vmstats_print()
   int tlb_faults = 0;
   int elf_plus_swap_reads = 0;
   int disk_reads = 0;
+  int allocs = 0;
+  int swap_writes = 0;
+  int elf_reads = 0;
+  int zswap_bytes = 0;
+  int swap_reads = 0;
 
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
@@ -132,7 +262,8 @@ _vmstats_print()
   free_plus_replace = stats_counts[VMSTAT_TLB_FAULT_FREE] + stats_counts[VMSTAT_TLB_FAULT_REPLACE];
   disk_plus_zeroed_plus_reload = stats_counts[VMSTAT_PAGE_FAULT_DISK] +
     stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD];
-  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ];
+  elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ] +
+    stats_counts[VMSTAT_MMAP_FILE_READ] + stats_counts[VMSTAT_ZSWAP_HIT];
   disk_reads = stats_counts[VMSTAT_PAGE_FAULT_DISK];
 
   kprintf("VMSTAT TLB Faults with Free + TLB Faults with Replace = %d\n", free_plus_replace);
@@ -147,12 +278,61 @@ _vmstats_print()
       tlb_faults, disk_plus_zeroed_plus_reload); 
   }
 
-  kprintf("VMSTAT ELF File reads + Swapfile reads = %d\n", elf_plus_swap_reads);
+  kprintf("VMSTAT ELF File reads + Swapfile reads + Mapped File reads + Compressed Swap Hits = %d\n",
+    elf_plus_swap_reads);
   if (disk_reads != elf_plus_swap_reads) {
-    kprintf("WARNING: ELF File reads + Swapfile reads != Page Faults (Disk) %d\n",
+    kprintf("WARNING: ELF File reads + Swapfile reads + Mapped File reads + Compressed Swap Hits != Page Faults (Disk) %d\n",
        elf_plus_swap_reads);
   }
 
+  /* average work done per physical page allocation */
+  allocs = stats_counts[VMSTAT_COREMAP_ALLOC];
+  if (allocs > 0) {
+    kprintf("VMSTAT Coremap Alloc Steps / Coremap Allocations = %d.%02d\n",
+      stats_counts[VMSTAT_COREMAP_ALLOC_STEPS] / allocs,
+      (stats_counts[VMSTAT_COREMAP_ALLOC_STEPS] % allocs) * 100 / allocs);
+  }
+
+  /* average number of pages per write to the swapfile */
+  swap_writes = stats_counts[VMSTAT_SWAP_FILE_WRITE_OPS];
+  if (swap_writes > 0) {
+    kprintf("VMSTAT Swapfile Writes / Swapfile Write Requests = %d.%02d\n",
+      stats_counts[VMSTAT_SWAP_FILE_WRITE] / swap_writes,
+      (stats_counts[VMSTAT_SWAP_FILE_WRITE] % swap_writes) * 100 / swap_writes);
+  }
+
+  /* average number of pages per read from the executable */
+  elf_reads = stats_counts[VMSTAT_ELF_FILE_READ];
+  if (elf_reads > 0) {
+    kprintf("VMSTAT (ELF File reads + ELF Fault-around Pages) / ELF File reads = %d.%02d\n",
+      (elf_reads + stats_counts[VMSTAT_ELF_FAULT_AROUND]) / elf_reads,
+      ((elf_reads + stats_counts[VMSTAT_ELF_FAULT_AROUND]) % elf_reads) * 100 / elf_reads);
+  }
+
+  /* size of the pages kept compressed over the memory they take */
+  zswap_bytes = stats_counts[VMSTAT_ZSWAP_BYTES];
+  if (zswap_bytes > 0) {
+    kprintf("VMSTAT Compressed Swap Stores * Page Size / Compressed Swap Bytes = %d.%02d\n",
+      stats_counts[VMSTAT_ZSWAP_STORE] * PAGE_SIZE / zswap_bytes,
+      (stats_counts[VMSTAT_ZSWAP_STORE] * PAGE_SIZE % zswap_bytes) * 100 / zswap_bytes);
+  }
+
+  /* share of swap ins that needed no I/O */
+  swap_reads = stats_counts[VMSTAT_ZSWAP_HIT] + stats_counts[VMSTAT_SWAP_FILE_READ];
+  if (swap_reads > 0) {
+    kprintf("VMSTAT Compressed Swap Hits / (Compressed Swap Hits + Swapfile reads) = %d%%\n",
+      stats_counts[VMSTAT_ZSWAP_HIT] * 100 / swap_reads);
+  }
+
+  /* how long faults took */
+  for (i=0; i<VMSTAT_NBUCKETS; i++) {
+    if (stats_hist[i] > 0) {
+      kprintf("VMSTAT Faults taking %s %8u us = %10u\n",
+        i < VMSTAT_NBUCKETS - 1 ? "under" : "over ",
+        i < VMSTAT_NBUCKETS - 1 ? 1 << i : 1 << (i - 1), stats_hist[i]);
+    }
+  }
+
 }
 /* ---------------------------------------------------------------------- */
 
@@ -13,6 +13,7 @@
 #include <pt.h>
 #include <vm.h>
 #include <swapfile.h>
+#include <clock.h>
 #include "opt-A3.h"
 #include "uw-vmstats.h"
 
@@ -25,6 +26,7 @@ void vm_bootstrap(void) {
 
 void vm_shutdown(void) {
     _vmstats_print();
+    coremap_printstats();
 }
 
 static int tlb_get_rr_victim() {
@@ -37,52 +39,32 @@ static int tlb_get_rr_victim() {
 
 static 
 void 
-tlb_replace(struct addrspace *as, vaddr_t faultaddress, paddr_t paddr) {
+tlb_replace(vaddr_t faultaddress, u_int32_t elo) {
 	vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
 
     // find victim to replace
     u_int32_t victim = tlb_get_rr_victim();
     u_int32_t ehi = faultaddress;
-    u_int32_t elo = paddr | TLBLO_VALID;
 
-    // mark as dirtiable if writeable
-    if (as_writeable(as, faultaddress)) {
-        elo |= TLBLO_DIRTY;
-    }
-
-    DEBUG(DB_VM, "vm_tlb: 0x%x -> 0x%x\n", faultaddress, paddr);
+    DEBUG(DB_VM, "vm_tlb: 0x%x -> 0x%x\n", faultaddress, elo & PAGE_FRAME);
 
 	// evict the victim   
 	TLB_Write(ehi, elo, victim);
 }
 
-int
-vm_fault(int faulttype, vaddr_t faultaddress)
+static int
+vm_fault_serve(int faulttype, vaddr_t faultaddress)
 {
    // vmstats_inc(VMSTAT_TLB_FAULT);
 	struct addrspace *as;
 	paddr_t paddr;
-	u_int32_t ehi, elo;
+	u_int32_t ehi, elo, oldelo;
 	int i, spl, err = 0;
 
-	spl = splhigh();
-	
 	faultaddress &= PAGE_FRAME;
 
 	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
 
-	switch (faulttype) {
-	    case VM_FAULT_READONLY:
-            splx(spl);
-            kill_process(-1);
-	    case VM_FAULT_READ:
-	    case VM_FAULT_WRITE:
-		break;
-	    default:
-		splx(spl);
-		return EINVAL;
-	}
-
 	as = curthread->t_vmspace;
 	if (as == NULL) {
 		/*
@@ -90,61 +72,103 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		 * fault early in boot. Return EFAULT so as to panic
 		 * instead of getting into an infinite faulting loop.
 		 */
-        splx(spl);
 		return EFAULT;
 	}
 
+	// the page table lock is held for the rest of the fault, including
+	// any disk I/O, so other threads keep running meanwhile. interrupts
+	// are only turned off to update the TLB
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+            // writable pages are mapped read-only until their first write
+            // so that we know which pages need to be swapped out. anything
+            // else is a real protection fault
+            if (!as_writeable(as, faultaddress)) {
+                kill_process(-1);
+            }
+            vmstats_inc(VMSTAT_TLB_FAULT_DIRTY);
+
+            // the page is resident and already in the TLB. upgrade the
+            // entry in place, the TLB must never map a page twice. if we
+            // were switched out before getting the lock the TLB has been
+            // flushed and the page may be gone, so the access is retried
+            pt_lock(as->as_pt);
+            spl = splhigh();
+            i = TLB_Probe(faultaddress, 0);
+            splx(spl);
+            if (i >= 0) {
+                paddr = pt_set_dirty(as->as_pt, faultaddress);
+                spl = splhigh();
+                i = TLB_Probe(faultaddress, 0);
+                if (i >= 0) {
+                    TLB_Write(faultaddress, paddr | TLBLO_VALID | TLBLO_DIRTY, i);
+                }
+                splx(spl);
+            }
+            pt_unlock(as->as_pt);
+            return 0;
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
 	// Assert that the address space has been set up properly.
 	assert(as->as_vbase1 != 0);
 	assert(as->as_npages1 != 0);
 	assert(as->as_vbase2 != 0);
 	assert(as->as_npages2 != 0);
-    assert(as->as_stackpbase != 0);
 	assert((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
 	assert((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
-    assert((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
 
 
-    // address exception. kill process
+    // address exception, unless the stack can grow to cover it
     int seg = as_contains(curthread->t_vmspace, faultaddress);
+    if (!seg) {
+        seg = as_grow_stack(as, faultaddress, curthread->t_usersp);
+    }
     if (!seg) {
         kprintf("address exception. killing process\n");
         kill_process(-1);
     }
 
-    if (seg == SEG_STCK) {
-		vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);		
-        vaddr_t stackbase = USERSTACK - VM_STACKPAGES * PAGE_SIZE;
-        paddr = (faultaddress - stackbase) + as->as_stackpbase;
+    // look in current process page table for frame number. writes to
+    // writable pages mark them dirty, writes to text are caught by the
+    // read-only fault that follows
+    pt_lock(as->as_pt);
+    paddr = pt_lookup(as->as_pt, faultaddress,
+            faulttype == VM_FAULT_WRITE && as_writeable(as, faultaddress),
+            &err);
+    if (err) {
+        pt_unlock(as->as_pt);
+        return err;
     }
-    else {
-        // look in current process page table for frame number
-        paddr = pt_lookup(get_curprocess()->page_table, faultaddress, &err);
-        if (err) {
-            splx(spl);
-            return err;
-        }
+
+    elo = ALIGN(paddr) | TLBLO_VALID;
+    if (IS_DIRTY(paddr)) {
+        elo |= TLBLO_DIRTY;
     }
+    paddr = ALIGN(paddr);
+    coremap_set_referenced(paddr);
 
     assert((paddr & PAGE_FRAME) > 0);
 
 	// make sure it's page-aligned 
 	assert((paddr & PAGE_FRAME)==paddr);
 
+	// the entry goes in before the lock is dropped, so the page cannot
+	// be evicted in between
+	spl = splhigh();
 
 	for (i=0; i<NUM_TLB; i++) {
-		TLB_Read(&ehi, &elo, i);
+		TLB_Read(&ehi, &oldelo, i);
 
-		if (elo & TLBLO_VALID){
+		if (oldelo & TLBLO_VALID){
 			continue;
 		}
 
 		ehi = faultaddress;
-        elo = paddr | TLBLO_VALID;
-
-        if (as_writeable(as, faultaddress)) {
-            elo |= TLBLO_DIRTY;
-        }
 
 		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
 
@@ -152,17 +176,36 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		vmstats_inc(VMSTAT_TLB_FAULT);
 		TLB_Write(ehi, elo, i);			
 		splx(spl);
+		pt_unlock(as->as_pt);
 		return 0;
 	}
 
     // TLB FULL
 	vmstats_inc(VMSTAT_TLB_FAULT);
-    tlb_replace(as, faultaddress, paddr);
+    tlb_replace(faultaddress, elo);
 	
     splx(spl);
+    pt_unlock(as->as_pt);
     return 0;
 }
 
+// times every fault for the fault time histogram
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+    time_t start_s, end_s;
+    u_int32_t start_ns, end_ns;
+    int err;
+
+    gettime(&start_s, &start_ns);
+    err = vm_fault_serve(faulttype, faultaddress);
+    gettime(&end_s, &end_ns);
+
+    vmstats_fault_time((end_s - start_s) * 1000000 +
+                       end_ns / 1000 - start_ns / 1000);
+    return err;
+}
+
 /* Allocate/free some kernel-space virtual pages */
 vaddr_t 
 alloc_kpages(int npages)
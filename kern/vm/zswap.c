@@ -0,0 +1,195 @@
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swapfile.h>
+#include <zswap.h>
+#include <machine/spl.h>
+#include "uw-vmstats.h"
+
+
+// at most 1/ZSWAP_SHARE of physical memory holds compressed pages
+#define ZSWAP_SHARE 8
+// pages that do not compress to this size go to the swapfile
+#define ZSWAP_MAX_LEN (PAGE_SIZE / 2)
+
+// a run starts with a byte holding its length less one, with ZRUN_REPEAT
+// set if it is one word repeated rather than that many words
+#define ZRUN_REPEAT 0x80
+#define ZRUN_MAX 0x80
+#define ZPAGE_WORDS (PAGE_SIZE / sizeof(u_int32_t))
+
+// compressed contents and their length for each swap slot, NULL for
+// slots whose contents are in the swapfile
+static char **zswap_data;
+static u_int16_t *zswap_len;
+
+// bytes of compressed pages kept, and how many may be
+static u_int32_t zswap_used;
+static u_int32_t zswap_budget;
+
+// pages are compressed here first to find out how big they are. only
+// used with swap_lock held
+static char zswap_buffer[ZSWAP_MAX_LEN];
+
+void zswap_bootstrap() {
+    u_int32_t i;
+
+    zswap_data = kmalloc(MAX_SWAPPED_PAGES * sizeof(char *));
+    assert(zswap_data);
+    zswap_len = kmalloc(MAX_SWAPPED_PAGES * sizeof(u_int16_t));
+    assert(zswap_len);
+
+    for (i = 0; i < MAX_SWAPPED_PAGES; i++) {
+        zswap_data[i] = NULL;
+        zswap_len[i] = 0;
+    }
+
+    zswap_used = 0;
+    zswap_budget = coremap_npages() / ZSWAP_SHARE * PAGE_SIZE;
+}
+
+// compresses a page into out. returns its compressed length, 0 if that
+// would be more than max
+static u_int32_t zswap_compress(const u_int32_t *in, unsigned char *out,
+                                u_int32_t max) {
+    u_int32_t i = 0, n, len = 0;
+
+    while (i < ZPAGE_WORDS) {
+        // a repeat of two words already takes less room than both
+        n = 1;
+        while (i + n < ZPAGE_WORDS && n < ZRUN_MAX && in[i + n] == in[i]) {
+            n++;
+        }
+        if (n > 1) {
+            if (len + 1 + sizeof(u_int32_t) > max) {
+                return 0;
+            }
+            out[len++] = ZRUN_REPEAT | (n - 1);
+            memcpy(out + len, &in[i], sizeof(u_int32_t));
+            len += sizeof(u_int32_t);
+            i += n;
+            continue;
+        }
+
+        // words as they are, up to where the next repeat starts
+        while (i + n < ZPAGE_WORDS && n < ZRUN_MAX &&
+               !(i + n + 1 < ZPAGE_WORDS && in[i + n] == in[i + n + 1])) {
+            n++;
+        }
+        if (len + 1 + n * sizeof(u_int32_t) > max) {
+            return 0;
+        }
+        out[len++] = n - 1;
+        memcpy(out + len, &in[i], n * sizeof(u_int32_t));
+        len += n * sizeof(u_int32_t);
+        i += n;
+    }
+
+    return len;
+}
+
+static void zswap_decompress(const unsigned char *in, u_int32_t len,
+                             u_int32_t *out) {
+    u_int32_t i = 0, pos = 0, n, word;
+
+    while (pos < len) {
+        n = (in[pos] & ~ZRUN_REPEAT) + 1;
+        assert(i + n <= ZPAGE_WORDS);
+        if (in[pos++] & ZRUN_REPEAT) {
+            memcpy(&word, in + pos, sizeof(u_int32_t));
+            pos += sizeof(u_int32_t);
+            while (n-- > 0) {
+                out[i++] = word;
+            }
+        }
+        else {
+            memcpy(&out[i], in + pos, n * sizeof(u_int32_t));
+            pos += n * sizeof(u_int32_t);
+            i += n;
+        }
+    }
+
+    assert(i == ZPAGE_WORDS);
+}
+
+int zswap_store(u_int32_t slot, const void *page) {
+    int spl;
+    u_int32_t len;
+    char *data;
+
+    // slots further out on a large swap device always go to disk
+    if (slot >= MAX_SWAPPED_PAGES) {
+        return 0;
+    }
+    assert(zswap_data[slot] == NULL);
+
+    len = zswap_compress(page, (unsigned char *)zswap_buffer, ZSWAP_MAX_LEN);
+    if (len == 0) {
+        return 0;
+    }
+
+    // claim the room before allocating, slots are freed without swap_lock
+    spl = splhigh();
+    if (zswap_used + len > zswap_budget) {
+        splx(spl);
+        vmstats_inc(VMSTAT_ZSWAP_FULL);
+        return 0;
+    }
+    zswap_used += len;
+    splx(spl);
+
+    data = kmalloc(len);
+    if (data == NULL) {
+        spl = splhigh();
+        zswap_used -= len;
+        splx(spl);
+        vmstats_inc(VMSTAT_ZSWAP_FULL);
+        return 0;
+    }
+    memcpy(data, zswap_buffer, len);
+
+    spl = splhigh();
+    zswap_data[slot] = data;
+    zswap_len[slot] = len;
+    splx(spl);
+
+    vmstats_inc(VMSTAT_ZSWAP_STORE);
+    vmstats_add(VMSTAT_ZSWAP_BYTES, len);
+    return 1;
+}
+
+int zswap_load(u_int32_t slot, void *page) {
+    // the slot is in use by the caller, so it cannot be dropped meanwhile
+    if (slot >= MAX_SWAPPED_PAGES || zswap_data[slot] == NULL) {
+        return 0;
+    }
+    zswap_decompress((unsigned char *)zswap_data[slot], zswap_len[slot], page);
+    return 1;
+}
+
+int zswap_contains(u_int32_t slot) {
+    return slot < MAX_SWAPPED_PAGES && zswap_data[slot] != NULL;
+}
+
+void zswap_drop(u_int32_t slot) {
+    int spl;
+    char *data;
+
+    if (slot >= MAX_SWAPPED_PAGES) {
+        return;
+    }
+
+    spl = splhigh();
+    data = zswap_data[slot];
+    if (data != NULL) {
+        zswap_used -= zswap_len[slot];
+        zswap_data[slot] = NULL;
+        zswap_len[slot] = 0;
+    }
+    splx(spl);
+
+    if (data != NULL) {
+        kfree(data);
+    }
+}
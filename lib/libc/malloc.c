@@ -0,0 +1,322 @@
+/*
+ * User-level malloc and free, on top of sbrk.
+ *
+ * The heap is one run of blocks, each starting with a size_t header
+ * holding the size of the block (header included) and two flag bits.
+ * Payloads are 8-byte aligned. Everything between the end of the last
+ * block (heap_top) and the break (heap_end) is unused.
+ *
+ * Small blocks (up to SMALLMAX bytes) are kept on one free list per
+ * size after they are freed and are reused as they are, without being
+ * merged with anything. Larger free blocks, and the pieces left over
+ * when one is split, go on a single list and are merged with free
+ * neighbours using a footer that repeats their size.
+ * A free block that ends at heap_top gives its space back to the top
+ * of the heap, and once enough is free there it is returned to the
+ * kernel with a negative sbrk.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * For a thread-safe libc, declare a lock for this file and change
+ * these to be nonempty.
+ */
+#define LOCKME()
+#define UNLOCKME()
+
+#define ALIGNMENT	8
+#define HDRSIZE		sizeof(size_t)
+#define MINBLOCK	(2 * HDRSIZE + 2 * sizeof(void *)) /* header, links, footer */
+#define SMALLMAX	512		/* largest block kept per size */
+#define NSMALL		(SMALLMAX / ALIGNMENT + 1)
+#define CHUNKSIZE	4096		/* heap grows by multiples of this */
+#define TRIMSIZE	(4 * CHUNKSIZE)	/* give back free space past this */
+
+#define INUSE		0x1	/* allocated, or on a small free list */
+#define PREVFREE	0x2	/* block before this one is free and large */
+#define FLAGS		0x7
+
+struct block {
+	size_t size;
+	/* the rest is only valid while the block is free */
+	struct block *next;
+	struct block *prev;
+};
+
+#define BSIZE(b)	((b)->size & ~(size_t)FLAGS)
+#define NEXTBLOCK(b)	((struct block *)((char *)(b) + BSIZE(b)))
+#define FOOTER(b)	(*(size_t *)((char *)(b) + BSIZE(b) - HDRSIZE))
+#define PAYLOAD(b)	((void *)((char *)(b) + HDRSIZE))
+#define HEADER(p)	((struct block *)((char *)(p) - HDRSIZE))
+
+static char *heap_top;
+static char *heap_end;
+static struct block *smallbins[NSMALL];
+static struct block *largelist;
+
+static
+void
+large_insert(struct block *b)
+{
+	b->prev = NULL;
+	b->next = largelist;
+	if (largelist != NULL) {
+		largelist->prev = b;
+	}
+	largelist = b;
+}
+
+static
+void
+large_remove(struct block *b)
+{
+	if (b->prev != NULL) {
+		b->prev->next = b->next;
+	}
+	else {
+		largelist = b->next;
+	}
+	if (b->next != NULL) {
+		b->next->prev = b->prev;
+	}
+}
+
+/*
+ * Make sure there are at least NEED bytes between heap_top and
+ * heap_end, plus room for a header after them. Returns 0 on success.
+ */
+static
+int
+grow(size_t need)
+{
+	char *old;
+	size_t avail = heap_end - heap_top;
+	size_t amount;
+
+	need += HDRSIZE;
+	if (avail >= need) {
+		return 0;
+	}
+
+	/* extra room in case the start needs aligning */
+	amount = (need - avail + ALIGNMENT + CHUNKSIZE - 1) & ~(CHUNKSIZE - 1);
+	if ((int)amount < 0) {
+		return -1;
+	}
+
+	old = sbrk(amount);
+	if (old == (void *)-1) {
+		return -1;
+	}
+
+	if (old != heap_end) {
+		/*
+		 * First call, or somebody else moved the break. Fence off
+		 * what we had with an in-use header so the blocks below it
+		 * never merge past it, and start over at the new memory,
+		 * with the headers placed so that the payloads are aligned.
+		 */
+		if (heap_top != NULL) {
+			((struct block *)heap_top)->size = INUSE;
+		}
+		heap_top = old + (2 * ALIGNMENT - HDRSIZE -
+		    (unsigned long)old % ALIGNMENT) % ALIGNMENT;
+	}
+	heap_end = old + amount;
+
+	return (size_t)(heap_end - heap_top) >= need ? 0 : -1;
+}
+
+/*
+ * Return free space at the top of the heap to the kernel, keeping
+ * one chunk around for the next allocation.
+ */
+static
+void
+trim(void)
+{
+	size_t excess = heap_end - heap_top;
+
+	if (excess < TRIMSIZE || sbrk(0) != heap_end) {
+		return;
+	}
+
+	excess = (excess - CHUNKSIZE) & ~(CHUNKSIZE - 1);
+	if (sbrk(-(int)excess) != (void *)-1) {
+		heap_end -= excess;
+	}
+}
+
+/*
+ * Put a free block on the coalescing list, merging it with the free
+ * blocks on either side of it. Its size field must hold its size and
+ * PREVFREE flag.
+ */
+static
+void
+release(struct block *b)
+{
+	struct block *next, *prev;
+	size_t size = BSIZE(b);
+
+	if (b->size & PREVFREE) {
+		prev = (struct block *)((char *)b - *((size_t *)b - 1));
+		large_remove(prev);
+		size += BSIZE(prev);
+		b = prev;
+	}
+
+	next = (struct block *)((char *)b + size);
+	if ((char *)next == heap_top) {
+		heap_top = (char *)b;
+		trim();
+		return;
+	}
+
+	if (!(next->size & INUSE)) {
+		large_remove(next);
+		size += BSIZE(next);
+		next = (struct block *)((char *)b + size);
+	}
+
+	b->size = size;
+	FOOTER(b) = size;
+	next->size |= PREVFREE;
+	large_insert(b);
+}
+
+void *
+malloc(size_t size)
+{
+	struct block *b, *rest;
+	size_t bsize;
+
+	if (size > (size_t)-1 - HDRSIZE - ALIGNMENT) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	bsize = (size + HDRSIZE + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+	if (bsize < MINBLOCK) {
+		bsize = MINBLOCK;
+	}
+
+	LOCKME();
+
+	/* exact fit from the small lists */
+	if (bsize <= SMALLMAX && smallbins[bsize / ALIGNMENT] != NULL) {
+		b = smallbins[bsize / ALIGNMENT];
+		smallbins[bsize / ALIGNMENT] = b->next;
+		UNLOCKME();
+		return PAYLOAD(b);
+	}
+
+	/* first fit from the large free blocks */
+	for (b = largelist; b != NULL; b = b->next) {
+		if (BSIZE(b) >= bsize) {
+			break;
+		}
+	}
+
+	if (b != NULL) {
+		large_remove(b);
+		if (BSIZE(b) - bsize >= MINBLOCK) {
+			/* the rest stays on the list whatever its size */
+			rest = (struct block *)((char *)b + bsize);
+			rest->size = BSIZE(b) - bsize;
+			b->size = bsize | INUSE;
+			release(rest);
+		}
+		else {
+			b->size |= INUSE;
+			NEXTBLOCK(b)->size &= ~(size_t)PREVFREE;
+		}
+		UNLOCKME();
+		return PAYLOAD(b);
+	}
+
+	/* carve a new block off the top of the heap */
+	if (grow(bsize)) {
+		UNLOCKME();
+		errno = ENOMEM;
+		return NULL;
+	}
+	b = (struct block *)heap_top;
+	b->size = bsize | INUSE;
+	heap_top += bsize;
+
+	UNLOCKME();
+	return PAYLOAD(b);
+}
+
+void
+free(void *ptr)
+{
+	struct block *b;
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	LOCKME();
+	b = HEADER(ptr);
+	if (BSIZE(b) <= SMALLMAX) {
+		/* stays marked in use so its neighbours leave it alone */
+		b->next = smallbins[BSIZE(b) / ALIGNMENT];
+		smallbins[BSIZE(b) / ALIGNMENT] = b;
+	}
+	else {
+		b->size &= ~(size_t)INUSE;
+		release(b);
+	}
+	UNLOCKME();
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (size != 0 && nmemb > (size_t)-1 / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	ptr = malloc(nmemb * size);
+	if (ptr != NULL) {
+		memset(ptr, 0, nmemb * size);
+	}
+	return ptr;
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	void *newptr;
+	size_t oldsize;
+
+	if (ptr == NULL) {
+		return malloc(size);
+	}
+	if (size == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	oldsize = BSIZE(HEADER(ptr)) - HDRSIZE;
+	if (size <= oldsize) {
+		return ptr;
+	}
+
+	newptr = malloc(size);
+	if (newptr == NULL) {
+		return NULL;
+	}
+	memcpy(newptr, ptr, oldsize);
+	free(ptr);
+	return newptr;
+}
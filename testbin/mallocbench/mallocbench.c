@@ -0,0 +1,122 @@
+/*
+ * mallocbench.c
+ *
+ * Allocator microbenchmark. Keeps a table of live blocks and, for a
+ * fixed number of rounds, frees a random one and allocates a new one
+ * of random size in its place. Most requests are small; a few are
+ * large enough to go through the coalescing path. Every block is
+ * filled with a pattern that is checked when it is freed.
+ *
+ * Prints the number of malloc/free operations per second.
+ *
+ * Usage: mallocbench [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#define NSLOTS   256
+#define ROUNDS   20000
+#define SMALL    256
+#define LARGE    8192
+
+static char *slots[NSLOTS];
+static size_t sizes[NSLOTS];
+
+static
+size_t
+pick_size(void)
+{
+	/* one request in sixteen is large */
+	if (random() % 16 == 0) {
+		return SMALL + random() % LARGE;
+	}
+	return 1 + random() % SMALL;
+}
+
+static
+void
+fill(int i)
+{
+	size_t j;
+
+	for (j=0; j<sizes[i]; j++) {
+		slots[i][j] = (char)(i + j);
+	}
+}
+
+static
+void
+check(int i)
+{
+	size_t j;
+
+	for (j=0; j<sizes[i]; j++) {
+		if (slots[i][j] != (char)(i + j)) {
+			errx(1, "slot %d corrupted at byte %lu", i,
+			     (unsigned long)j);
+		}
+	}
+}
+
+static
+void
+alloc_slot(int i)
+{
+	sizes[i] = pick_size();
+	slots[i] = malloc(sizes[i]);
+	if (slots[i] == NULL) {
+		errx(1, "malloc of %lu bytes failed", (unsigned long)sizes[i]);
+	}
+	fill(i);
+}
+
+int
+main(int argc, char *argv[])
+{
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	unsigned long ms, ops;
+	int rounds = ROUNDS;
+	int i, r;
+
+	if (argc > 1) {
+		rounds = atoi(argv[1]);
+	}
+
+	srandom(350);
+
+	__time(&s0, &ns0);
+
+	for (i=0; i<NSLOTS; i++) {
+		alloc_slot(i);
+	}
+
+	for (r=0; r<rounds; r++) {
+		i = random() % NSLOTS;
+		check(i);
+		free(slots[i]);
+		alloc_slot(i);
+	}
+
+	for (i=0; i<NSLOTS; i++) {
+		check(i);
+		free(slots[i]);
+	}
+
+	__time(&s1, &ns1);
+
+	ops = 2 * (NSLOTS + (unsigned long)rounds);
+	ms = (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+	if (ms == 0) {
+		ms = 1;
+	}
+
+	printf("mallocbench: %lu operations in %lu ms\n", ops, ms);
+	printf("mallocbench: %lu operations/second\n", ops * 1000 / ms);
+	printf("mallocbench: heap break at %p\n", sbrk(0));
+
+	return 0;
+}
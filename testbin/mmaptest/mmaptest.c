@@ -0,0 +1,228 @@
+/*
+ * mmaptest.c
+ *
+ * Tests mmap, munmap and msync. Writes a file, maps it shared and
+ * private, and checks that:
+ *    - mapped pages hold what the file holds;
+ *    - stores to a shared mapping reach the file after msync, and
+ *      after munmap;
+ *    - stores to a private mapping never reach the file;
+ *    - a shared mapping is shared with a child after fork;
+ *    - anonymous mappings start out zeroed.
+ *
+ * Usage: mmaptest [file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define NPAGES   4
+#define PAGESIZE 4096
+#define FILESIZE (NPAGES * PAGESIZE)
+
+static char buf[FILESIZE];
+
+static
+void
+makefile(const char *name)
+{
+	int fd, i;
+
+	for (i=0; i<FILESIZE; i++) {
+		buf[i] = (char)(i * 7);
+	}
+
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s: open for write", name);
+	}
+	if (write(fd, buf, FILESIZE) != FILESIZE) {
+		err(1, "%s: write", name);
+	}
+	close(fd);
+}
+
+/* reads the file back into buf */
+static
+void
+readfile(const char *name)
+{
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open for read", name);
+	}
+	if (read(fd, buf, FILESIZE) != FILESIZE) {
+		err(1, "%s: read", name);
+	}
+	close(fd);
+}
+
+static
+char *
+mapfile(const char *name, int prot, int flags)
+{
+	int fd;
+	char *p;
+
+	fd = open(name, O_RDWR);
+	if (fd < 0) {
+		err(1, "%s: open", name);
+	}
+	p = mmap(NULL, FILESIZE, prot, flags, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "%s: mmap", name);
+	}
+	/* the mapping stays after the file is closed */
+	close(fd);
+	return p;
+}
+
+static
+void
+test_contents(const char *name)
+{
+	char *p;
+	int i;
+
+	p = mapfile(name, PROT_READ, MAP_SHARED);
+	for (i=0; i<FILESIZE; i++) {
+		if (p[i] != (char)(i * 7)) {
+			errx(1, "mapped byte %d is wrong", i);
+		}
+	}
+	if (munmap(p, FILESIZE)) {
+		err(1, "munmap");
+	}
+	printf("contents: passed\n");
+}
+
+static
+void
+test_shared(const char *name)
+{
+	char *p;
+
+	p = mapfile(name, PROT_READ|PROT_WRITE, MAP_SHARED);
+	p[0] = 'a';
+	p[PAGESIZE + 1] = 'b';
+	if (msync(p, FILESIZE, MS_SYNC)) {
+		err(1, "msync");
+	}
+	readfile(name);
+	if (buf[0] != 'a' || buf[PAGESIZE + 1] != 'b') {
+		errx(1, "stores to a shared mapping missing after msync");
+	}
+
+	p[3 * PAGESIZE] = 'c';
+	if (munmap(p, FILESIZE)) {
+		err(1, "munmap");
+	}
+	readfile(name);
+	if (buf[3 * PAGESIZE] != 'c') {
+		errx(1, "stores to a shared mapping missing after munmap");
+	}
+	printf("shared: passed\n");
+}
+
+static
+void
+test_private(const char *name)
+{
+	char *p;
+
+	p = mapfile(name, PROT_READ|PROT_WRITE, MAP_PRIVATE);
+	p[0] = 'x';
+	if (p[0] != 'x' || p[1] != (char)7) {
+		errx(1, "private mapping does not read back");
+	}
+	if (munmap(p, FILESIZE)) {
+		err(1, "munmap");
+	}
+	readfile(name);
+	if (buf[0] != 'a') {
+		errx(1, "stores to a private mapping reached the file");
+	}
+	printf("private: passed\n");
+}
+
+static
+void
+test_fork(const char *name)
+{
+	char *p;
+	int pid, status;
+
+	p = mapfile(name, PROT_READ|PROT_WRITE, MAP_SHARED);
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		p[2 * PAGESIZE] = 'f';
+		_exit(0);
+	}
+	waitpid(pid, &status, 0);
+	if (p[2 * PAGESIZE] != 'f') {
+		errx(1, "store by the child not seen by the parent");
+	}
+	if (munmap(p, FILESIZE)) {
+		err(1, "munmap");
+	}
+	printf("fork: passed\n");
+}
+
+static
+void
+test_anon(void)
+{
+	char *p;
+	int i;
+
+	p = mmap(NULL, 3 * PAGESIZE, PROT_READ|PROT_WRITE,
+		 MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap anonymous");
+	}
+	for (i=0; i<3 * PAGESIZE; i++) {
+		if (p[i] != 0) {
+			errx(1, "anonymous byte %d is not zero", i);
+		}
+		p[i] = (char)i;
+	}
+	for (i=0; i<3 * PAGESIZE; i++) {
+		if (p[i] != (char)i) {
+			errx(1, "anonymous byte %d does not read back", i);
+		}
+	}
+	if (munmap(p, 3 * PAGESIZE)) {
+		err(1, "munmap");
+	}
+	printf("anonymous: passed\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *name = "mmapfile";
+
+	if (argc > 1) {
+		name = argv[1];
+	}
+
+	makefile(name);
+	test_contents(name);
+	test_shared(name);
+	test_private(name);
+	test_fork(name);
+	test_anon();
+
+	/* the file is left behind, the next run truncates it */
+
+	printf("mmaptest done.\n");
+	return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * vmstattest.c
+ *
+ * Tests the vmstat system call. Touches pages of a large array and
+ * checks that:
+ *    - they are charged to this process as zero fills and TLB faults;
+ *    - the fault time histogram counts at least as many faults;
+ *    - a bad pid is rejected.
+ * Then prints the counters and the histogram.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/vmstat.h>
+
+#define NPAGES   64
+#define PAGESIZE 4096
+
+static char array[NPAGES * PAGESIZE];
+
+static
+unsigned int
+histsum(unsigned int *hist)
+{
+	unsigned int sum = 0;
+	int i;
+
+	for (i=0; i<VMSTAT_NBUCKETS; i++) {
+		sum += hist[i];
+	}
+	return sum;
+}
+
+int
+main(void)
+{
+	struct vmcounts before, after;
+	unsigned int hist1[VMSTAT_NBUCKETS], hist2[VMSTAT_NBUCKETS];
+	int i;
+
+	if (vmstat(getpid(), &before, hist1)) {
+		err(1, "vmstat");
+	}
+
+	for (i=0; i<NPAGES; i++) {
+		array[i * PAGESIZE] = 1;
+	}
+
+	if (vmstat(getpid(), &after, hist2)) {
+		err(1, "vmstat");
+	}
+
+	if (after.vc_zerofills - before.vc_zerofills < NPAGES) {
+		errx(1, "%u zero fills for %d new pages",
+		     after.vc_zerofills - before.vc_zerofills, NPAGES);
+	}
+	if (after.vc_tlbfaults - before.vc_tlbfaults < NPAGES) {
+		errx(1, "%u TLB faults for %d new pages",
+		     after.vc_tlbfaults - before.vc_tlbfaults, NPAGES);
+	}
+	if (histsum(hist2) - histsum(hist1) < NPAGES) {
+		errx(1, "%u faults timed for %d new pages",
+		     histsum(hist2) - histsum(hist1), NPAGES);
+	}
+
+	if (vmstat(-1, &after, NULL) == 0) {
+		errx(1, "vmstat accepted pid -1");
+	}
+
+	printf("tlbfaults %u zerofills %u elfreads %u swapreads %u "
+	       "swapwrites %u\n", after.vc_tlbfaults, after.vc_zerofills,
+	       after.vc_elfreads, after.vc_swapreads, after.vc_swapwrites);
+	for (i=0; i<VMSTAT_NBUCKETS; i++) {
+		if (hist2[i] > 0) {
+			printf("faults in bucket %d: %u\n", i, hist2[i]);
+		}
+	}
+
+	printf("vmstattest: passed\n");
+	return 0;
+}